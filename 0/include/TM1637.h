@@ -7,25 +7,34 @@ class TM1637 {
 public:
   static const uint8_t MINUS = 0B01000000;
   static const uint8_t DOT = 0B10000000;
+  static const uint8_t MAX_BACKOFF = 8; // Longest pause after a frame the chip did not acknowledge, ms
 
   TM1637(uint8_t brightness = 4);
 
   void setBrightness(uint8_t brightness) {
     _brightness = brightness < 7 ? brightness : 7;
   }
-  void clear() {
-    display(0);
+  bool clear() {
+    return display((uint32_t)0);
   }
-  void display(uint8_t pos, uint8_t segments);
-  void display(const uint8_t *segments);
-  void display(uint32_t segments);
-  void displayNum(int16_t num, bool leadingZero = false);
+  bool display(uint8_t pos, uint8_t segments);
+  bool display(const uint8_t *segments);
+  bool display(uint32_t segments);
+  bool displayNum(int16_t num, bool leadingZero = false);
   void operator=(int16_t num) {
     displayNum(num);
   }
 
   static uint8_t digitToSegments(int8_t digit);
 
+  // Bytes not acknowledged and frames skipped while backing off since power up, saturating
+  uint8_t errors() const {
+    return _errors;
+  }
+  uint8_t skipped() const {
+    return _skipped;
+  }
+
 protected:
   static const uint8_t ADDR_AUTO = 0x40;
   static const uint8_t ADDR_FIXED = 0x44;
@@ -35,8 +44,14 @@ protected:
   void _start();
   void _stop();
   bool _writeByte(uint8_t data);
+  uint8_t _frame(uint8_t command, uint8_t address, const uint8_t *data, uint8_t len);
+  bool _send(uint8_t command, uint8_t address, const uint8_t *data, uint8_t len);
 
   uint8_t _brightness;
+  uint8_t _errors;
+  uint8_t _skipped;
+  uint8_t _backoff; // Current pause in ms, 0 while the chip acknowledges
+  uint8_t _retryAt; // Low byte of millis() the pause ends
 };
 
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
@@ -44,58 +59,31 @@ TM1637<CLK_PIN, DIO_PIN>::TM1637(uint8_t brightness) {
   pinMode(CLK_PIN, OUTPUT);
   pinMode(DIO_PIN, OUTPUT);
   _brightness = brightness < 7 ? brightness : 7;
+  _errors = 0;
+  _skipped = 0;
+  _backoff = 0;
+  _retryAt = 0;
 }
 
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
-void TM1637<CLK_PIN, DIO_PIN>::display(uint8_t pos, uint8_t segments) {
-  if (pos < 4) {
-    _start();
-    _writeByte(ADDR_FIXED);
-    _stop();
-    _start();
-    _writeByte(STARTADDR + pos);
-    _writeByte(segments);
-    _stop();
-    _start();
-    _writeByte(0x88 | _brightness);
-    _stop();
-  }
+bool TM1637<CLK_PIN, DIO_PIN>::display(uint8_t pos, uint8_t segments) {
+  if (pos < 4)
+    return _send(ADDR_FIXED, STARTADDR + pos, &segments, 1);
+  return false;
 }
 
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
-void TM1637<CLK_PIN, DIO_PIN>::display(const uint8_t *segments) {
-  _start();
-  _writeByte(ADDR_AUTO);
-  _stop();
-  _start();
-  _writeByte(STARTADDR);
-  for (int8_t i = 0; i < 4; ++i) {
-    _writeByte(segments[i]);
-  }
-  _stop();
-  _start();
-  _writeByte(0x88 | _brightness);
-  _stop();
+bool TM1637<CLK_PIN, DIO_PIN>::display(const uint8_t *segments) {
+  return _send(ADDR_AUTO, STARTADDR, segments, 4);
 }
 
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
-void TM1637<CLK_PIN, DIO_PIN>::display(uint32_t segments) {
-  _start();
-  _writeByte(ADDR_AUTO);
-  _stop();
-  _start();
-  _writeByte(STARTADDR);
-  for (int8_t i = 0; i < 4; ++i) {
-    _writeByte(segments >> (8 * i));
-  }
-  _stop();
-  _start();
-  _writeByte(0x88 | _brightness);
-  _stop();
+bool TM1637<CLK_PIN, DIO_PIN>::display(uint32_t segments) {
+  return _send(ADDR_AUTO, STARTADDR, (const uint8_t *)&segments, 4); // AVR is little endian, so digit 0 comes first
 }
 
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
-void TM1637<CLK_PIN, DIO_PIN>::displayNum(int16_t num, bool leadingZero) {
+bool TM1637<CLK_PIN, DIO_PIN>::displayNum(int16_t num, bool leadingZero) {
   uint32_t data;
 
   if ((num < -999) || (num > 9999)) {
@@ -120,7 +108,7 @@ void TM1637<CLK_PIN, DIO_PIN>::displayNum(int16_t num, bool leadingZero) {
         data |= digitToSegments(num % 10);
     }
   }
-  display(data);
+  return display(data);
 }
 
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
@@ -136,6 +124,53 @@ uint8_t TM1637<CLK_PIN, DIO_PIN>::digitToSegments(int8_t digit) {
   return 0;
 }
 
+// Returns the number of bytes the chip did not acknowledge
+template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
+uint8_t TM1637<CLK_PIN, DIO_PIN>::_frame(uint8_t command, uint8_t address, const uint8_t *data, uint8_t len) {
+  uint8_t acks;
+
+  _start();
+  acks = _writeByte(command);
+  _stop();
+  _start();
+  acks += _writeByte(address);
+  for (uint8_t i = 0; i < len; ++i) {
+    acks += _writeByte(data[i]);
+  }
+  _stop();
+  _start();
+  acks += _writeByte(0x88 | _brightness);
+  _stop();
+  return len + 3 - acks;
+}
+
+/***
+ * Sends a frame unless the last one went unacknowledged less than a pause
+ * ago, which doubles with every failure up to MAX_BACKOFF. Nothing waits:
+ * a frame that fails or is skipped returns false, and the next draw of the
+ * caller is the retry.
+ */
+template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
+bool TM1637<CLK_PIN, DIO_PIN>::_send(uint8_t command, uint8_t address, const uint8_t *data, uint8_t len) {
+  uint8_t now = millis();
+  uint8_t nacks;
+
+  if (_backoff && ((int8_t)(now - _retryAt) < 0)) {
+    if (_skipped < 0xFF)
+      ++_skipped;
+    return false;
+  }
+  nacks = _frame(command, address, data, len);
+  if (! nacks) {
+    _backoff = 0;
+    return true;
+  }
+  _errors = nacks < 0xFF - _errors ? _errors + nacks : 0xFF;
+  _backoff = _backoff ? (_backoff < MAX_BACKOFF ? _backoff << 1 : MAX_BACKOFF) : 1;
+  _retryAt = now + _backoff;
+  return false;
+}
+
 template<const uint8_t CLK_PIN, const uint8_t DIO_PIN>
 inline void TM1637<CLK_PIN, DIO_PIN>::_bitDelay() {
   delayMicroseconds(50);
@@ -171,9 +206,9 @@ bool TM1637<CLK_PIN, DIO_PIN>::_writeByte(uint8_t data) {
   pinMode(DIO_PIN, INPUT);
   _bitDelay();
 
-  bool ack = digitalRead(DIO_PIN);
+  bool ack = ! digitalRead(DIO_PIN); // The chip pulls DIO low
 
-  if (! ack) {
+  if (ack) {
     pinMode(DIO_PIN, OUTPUT);
     digitalWrite(DIO_PIN, LOW);
   }
@@ -154,7 +154,7 @@ void loop() {
   }
 
   {
-    const uint8_t DIGITS[10] PROGMEM = {
+    static const uint8_t DIGITS[10] PROGMEM = {
       0B00111111, 0B00000110, 0B01011011, 0B01001111, 0B01100110, 0B01101101, 0B01111101, 0B0000111, 0B01111111, 0B01101111
     };
     const uint8_t MINUS = 0B01000000;
@@ -167,8 +167,8 @@ void loop() {
 
       if (draw) {
         if (score[i]) {
-          segments[i * 2] = pgm_read_byte(DIGITS[score[i] / 10]);
-          segments[i * 2 + 1] = pgm_read_byte(DIGITS[score[i] % 10]) | DOT;
+          segments[i * 2] = pgm_read_byte(&DIGITS[score[i] / 10]);
+          segments[i * 2 + 1] = pgm_read_byte(&DIGITS[score[i] % 10]) | DOT;
         } else {
           segments[i * 2] = MINUS;
           segments[i * 2 + 1] = MINUS | DOT;
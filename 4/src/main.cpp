@@ -1,71 +1,1260 @@
 #include <avr/sleep.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
 #include <util/delay.h>
 
-enum runstate_t : uint8_t { RUN_IDLE, RUN_LEFT, RUN_RIGHT };
+#ifndef KEYSCAN
+#define KEYSCAN 0 // Take the buttons from the TM1637 key matrix instead of PB1/PB2
+#endif
 
-const uint8_t MAX_SCORE = 20;
+#ifndef ENCODER
+#define ENCODER 0 // Quadrature encoder on PB0/PB1 in place of the "+" button
+#endif
+
+#ifndef ADAPTIVE_DEBOUNCE
+#define ADAPTIVE_DEBOUNCE 0 // Learn the debounce window of each button from its bounce
+#endif
+
+#ifndef DEBOUNCE_EEPROM
+#define DEBOUNCE_EEPROM 0 // Keep the learned windows in EEPROM (needs ADAPTIVE_DEBOUNCE)
+#endif
+
+#ifndef LIGHT_SENSOR
+#define LIGHT_SENSOR 0 // Follow ambient light from a sensor on ADC1 (PB2), needs KEYSCAN
+#endif
+
+#ifndef BATTERY_MONITOR
+#define BATTERY_MONITOR 0 // Blink the dots on low supply, divider on ADC1 (PB2), needs KEYSCAN
+#endif
+
+#ifndef BUZZER
+#define BUZZER 0 // Piezo on PB0 (OC0A) clicks on points and plays a tune at 0 and MAX_SCORE
+#endif
+
+#ifndef ANIMATIONS
+#define ANIMATIONS 0 // Flash "Over" when a score runs out and scroll "rESEt" on a reset
+#endif
+
+#ifndef MATCH_MODE
+#define MATCH_MODE 0 // Scores count up to sets won by two, finished sets are kept in EEPROM
+#endif
+
+#ifndef UNDO
+#define UNDO 0 // A short chord takes back the last score changes, a held one resets
+#endif
+
+#ifndef CLOCK_MODE
+#define CLOCK_MODE 0 // Chess clock: each button hands the move to the other player's countdown
+#endif
+
+#ifndef CALIBRATE
+#define CALIBRATE 0 // Calibration build for CLOCK_MODE, times a reference interval into EEPROM
+#endif
+
+#ifndef STACK_PAINT
+#define STACK_PAINT 0 // Paint free SRAM at boot, a chord shows the untouched bytes instead of its usual job
+#endif
+
+#ifndef PROFILE
+#define PROFILE 0 // Deployment profile, an index into PROFILES
+#endif
+
+#define INPUT_POLL 0 // The tick reads PINB
+#define INPUT_HYBRID 1 // The tick polls while lit, as millis() must run, a blank display powers down until a pin change
+
+#ifndef INPUT_BACKEND
+#define INPUT_BACKEND INPUT_POLL // How the buttons are read, one of the above
+#endif
+
+enum runstate_t : uint8_t { RUN_IDLE, RUN_LEFT, RUN_RIGHT, RUN_BLANK }; // RUN_BLANK - idle with the display off
+
+/***
+ * Game and timing settings of a deployment, all in ms. The press tick, the
+ * Timer0 setup and the width of millis() are derived from the chosen one and
+ * F_CPU below, so a profile builds to the smallest code that still holds its
+ * timings:
+ * 0 - club table, a game from 20 down
+ * 1 - referee, a game from 21 down, more time to pick a side, slower repeat
+ * 2 - battery, fades out after 10 sec. idle, snappier buttons
+ */
+struct profile_t {
+  uint8_t maxScore;
+  uint16_t stateDuration; // Side stays selected after the last input
+  uint16_t fadeTime; // Without input before idle brightness starts going down
+  uint16_t debounceTime;
+  uint16_t holdTime;
+  uint16_t repeatTime; // First repeats of a held button
+};
+
+constexpr profile_t PROFILES[] = {
+  { 20, 2000, 30000, 50, 500, 200 },
+  { 21, 3000, 30000, 50, 600, 250 },
+  { 20, 2000, 10000, 30, 400, 150 }
+};
+
+static_assert(PROFILE < sizeof(PROFILES) / sizeof(PROFILES[0]), "No such PROFILE");
+
+constexpr profile_t CONFIG = PROFILES[PROFILE < sizeof(PROFILES) / sizeof(PROFILES[0]) ? PROFILE : 0];
+
+const uint8_t MAX_SCORE = CONFIG.maxScore;
+
+static_assert((MAX_SCORE > 0) && (MAX_SCORE <= 99), "Scores show 2 digits");
+#if MATCH_MODE
+const uint8_t SET_POINTS = 11; // A set goes to the first with 11 points
+const uint8_t WIN_BY = 2; // and a lead of 2
+const uint8_t MATCH_SETS = 3; // Sets to win the match, best of 5
+const uint8_t START_SCORE = 0;
+#else
+const uint8_t START_SCORE = MAX_SCORE;
+#endif
+#if CLOCK_MODE
+const uint8_t CLOCK_MINUTES = 5; // Time per player
+#if CALIBRATE
+const uint16_t CALIBRATE_SECONDS = 600; // Reference interval, stop at 10:00 on a good stopwatch
+#endif
+
+static_assert(CLOCK_MINUTES < 100, "Clocks show 2 digits of minutes");
+static_assert(! (MATCH_MODE || UNDO), "Clock mode replaces scoring");
+#elif CALIBRATE
+#error "CALIBRATE needs CLOCK_MODE"
+#endif
 const uint8_t NORMAL_BRIGHT = 4;
 const uint8_t DIM_BRIGHT = 2;
-const uint16_t STATE_DURATION = 2000; // 2 sec.
+const uint16_t STATE_DURATION = CONFIG.stateDuration;
+const uint16_t FADE_TIME = CONFIG.fadeTime;
+const uint16_t FADE_STEP = 500; // 0.5 sec. per brightness level, then blank
+
+const uint8_t DISPLAY_ON = 0x88; // TM1637 display control, | brightness
+const uint8_t DISPLAY_OFF = 0x80;
 
 const uint8_t TM_CLK_PIN = PB3;
 const uint8_t TM_DIO_PIN = PB4;
 
 const uint8_t BTN_PINS[2] = { PB2, PB1 };
 
-const uint16_t DEBOUNCE_TIME = 50; // 50 ms.
-const uint16_t HOLD_TIME = 500; // 0.5 sec.
-const uint16_t REPEAT_TIME = 200; // 0.2 sec.
+#if KEYSCAN
+const uint8_t KEYSCAN_TIME = 10; // Key matrix is read every 10 ms.
+
+static_assert(KEYSCAN_TIME < 0x80, "Scans are timed on the low byte of millis()");
 
-volatile uint8_t score[2] = { MAX_SCORE, MAX_SCORE };
-volatile uint16_t _ms = 0;
-volatile uint16_t stateTime = 0;
-volatile runstate_t runstate = RUN_IDLE;
-volatile uint8_t brightness = DIM_BRIGHT;
+/***
+ * Buttons (bit mask) behind each TM1637 key, K1/SG1..SG8 then K2/SG1..SG8.
+ * The chip reports one key at a time, so the reset chord gets a key of its own.
+ */
+const uint8_t KEYMAP[16] PROGMEM = {
+  0x01, 0x02, 0x03, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0
+};
+#endif
+
+#if ENCODER
+const uint8_t ENC_PINS[2] = { PB0, PB1 }; // A, B (swap to reverse the direction), B shares the "+" button pin
+const int8_t ENC_STEPS = 4; // Quadrature transitions per detent
+#endif
+
+static_assert(INPUT_BACKEND <= INPUT_HYBRID, "No such INPUT_BACKEND");
+#if INPUT_BACKEND == INPUT_HYBRID
+static_assert(! (KEYSCAN || ENCODER), "Pin change input needs both buttons on PB1/PB2, and the encoder owns PCINT0_vect");
+#endif
+
+#if BUZZER
+const uint8_t BUZZER_PIN = PB0; // OC0A
+
+static_assert(! ENCODER, "Buzzer and encoder A both want PB0");
+#endif
+
+#if LIGHT_SENSOR
+/***
+ * PB0 has no ADC input on the ATtiny13 (only AIN0 of the comparator), so the
+ * sensor divider goes to ADC1 on PB2, which KEYSCAN frees from the "-" button.
+ * Brighter light must give a higher voltage.
+ */
+const uint8_t LIGHT_MUX = 1; // ADC1 (PB2), VCC reference
+const uint16_t LIGHT_TIME = 500; // Light is sampled every 0.5 sec.
+const uint8_t LIGHT_HYSTERESIS = 8; // Of 256, keeps a reading at a level boundary from flickering
+
+static_assert(KEYSCAN, "PB2 is the \"-\" button unless KEYSCAN moves the buttons to the TM1637");
+#endif
+
+#if BATTERY_MONITOR
+/***
+ * The ATtiny13 ADC cannot select the bandgap as an input, so the supply is
+ * measured through a divider against the internal 1.1 V reference instead.
+ * Keep the divider high-ohmic (1 M / 330 k draws 3 uA) with 100 nF across
+ * the lower resistor to feed the ADC.
+ */
+const uint8_t BATTERY_MUX = (1 << REFS0) | 1; // ADC1 (PB2), 1.1 V reference
+const uint8_t BATTERY_DIVIDER = 4; // VCC / ADC1
+const uint16_t BATTERY_TIME = 15000; // Supply is sampled every 15 sec.
+const uint16_t LOW_BATTERY = 3500; // mV, dots blink below
+const uint16_t GOOD_BATTERY = 3600; // mV, and stop above
 
-inline uint16_t millis() {
+constexpr uint16_t batteryReading(uint16_t mv) {
+  return (uint32_t)mv * 256 / (BATTERY_DIVIDER * 1100UL);
+}
+
+static_assert(batteryReading(GOOD_BATTERY) < 0xFF, "Divider too small for the 1.1 V reference");
+static_assert(KEYSCAN, "PB2 is the \"-\" button unless KEYSCAN moves the buttons to the TM1637");
+static_assert(! LIGHT_SENSOR, "Light sensor and battery divider both want ADC1");
+#endif
+
+const uint8_t MAX_BACKOFF = 64; // Longest wait before resending a frame the TM1637 did not acknowledge, ms.
+const uint16_t REFRESH_TIME = 5000; // Full frame even when nothing changed, in case a brown-out cleared the TM1637, ms.
+
+const uint8_t CLOCK_FULL = 0; // CLKPR divider as log2, 9.6 MHz while talking to the TM1637
+const uint8_t CLOCK_IDLE = 3; // 1.2 MHz the rest of the time
+
+const uint16_t DEBOUNCE_TIME = CONFIG.debounceTime;
+const uint16_t HOLD_TIME = CONFIG.holdTime;
+const uint16_t REPEAT_TIME = CONFIG.repeatTime;
+const uint16_t DOUBLE_TIME = 300; // 0.3 sec. from a release to the next press
+const uint16_t CHORD_TIME = 200; // 0.2 sec. between the two presses of a chord
+#if ADAPTIVE_DEBOUNCE
+const uint16_t MIN_DEBOUNCE_TIME = 10; // 10 ms.
+const uint16_t MAX_DEBOUNCE_TIME = 100; // 0.1 sec.
+#else
+const uint16_t MAX_DEBOUNCE_TIME = DEBOUNCE_TIME;
+#endif
+
+/***
+ * Buttons are sampled every PRESS_TICK ms, the finest power of 2 that keeps
+ * every press window in the 8-bit timers of state_t (bounce timers count up
+ * to twice the longest debounce window). Windows round up to whole ticks,
+ * so none comes out shorter than its time.
+ */
+constexpr uint16_t ticksOf(uint16_t ms, uint8_t tick) {
+  return (ms + tick - 1) / tick;
+}
+
+constexpr bool pressFits(uint8_t tick) {
+  return (ticksOf(HOLD_TIME, tick) < 0xFF) && (ticksOf(DOUBLE_TIME, tick) < 0xFF) && (ticksOf(CHORD_TIME, tick) < 0xFF) && (ticksOf(MAX_DEBOUNCE_TIME, tick) * 2 < 0xFF);
+}
+
+constexpr uint8_t pressTick(uint8_t tick = 1) {
+  return pressFits(tick) || (tick >= 0x80) ? tick : pressTick(tick * 2);
+}
+
+const uint8_t PRESS_TICK = pressTick();
+const uint8_t DEBOUNCE_TICKS = ticksOf(DEBOUNCE_TIME, PRESS_TICK);
+const uint8_t HOLD_TICKS = ticksOf(HOLD_TIME, PRESS_TICK);
+const uint8_t DOUBLE_TICKS = ticksOf(DOUBLE_TIME, PRESS_TICK);
+const uint8_t CHORD_TICKS = ticksOf(CHORD_TIME, PRESS_TICK);
+
+static_assert(pressFits(PRESS_TICK), "Press timers are 8-bit");
+static_assert(DEBOUNCE_TICKS >= 2, "Debounce needs two samples at the derived PRESS_TICK");
+static_assert(STATE_DURATION >= HOLD_TIME, "A side must stay selected through a hold");
+
+#if ADAPTIVE_DEBOUNCE
+const uint8_t MIN_DEBOUNCE_TICKS = ticksOf(MIN_DEBOUNCE_TIME, PRESS_TICK);
+const uint8_t MAX_DEBOUNCE_TICKS = ticksOf(MAX_DEBOUNCE_TIME, PRESS_TICK);
+
+static_assert(MIN_DEBOUNCE_TICKS > 0, "Shortest debounce window below PRESS_TICK");
+#else
+const uint8_t MAX_DEBOUNCE_TICKS = DEBOUNCE_TICKS;
+#endif
+
+/***
+ * millis() and every time kept from it are ms_t, the narrowest unsigned type
+ * in which the longest interval timed on it is at most half the range. Time
+ * is compared as (ms_t)(now - then), which stays right across a wrap as long
+ * as the check comes around before another half range passes.
+ */
+template<bool B, typename T, typename F> struct pick_t {
+  typedef T type;
+};
+
+template<typename T, typename F> struct pick_t<false, T, F> {
+  typedef F type;
+};
+
+template<uint32_t N> struct narrowest_t {
+  typedef typename pick_t<N <= 0xFF, uint8_t, typename pick_t<N <= 0xFFFF, uint16_t, uint32_t>::type>::type type;
+};
+
+constexpr uint32_t longer(uint32_t a, uint32_t b) {
+  return a > b ? a : b;
+}
+
+#if BATTERY_MONITOR
+const uint16_t SAMPLE_TIME = BATTERY_TIME; // Longest wait between sensor samples of the main loop
+#elif LIGHT_SENSOR
+const uint16_t SAMPLE_TIME = LIGHT_TIME;
+#else
+const uint16_t SAMPLE_TIME = 0;
+#endif
+
+const uint32_t LONGEST_TIME = longer(longer(STATE_DURATION, (uint32_t)FADE_TIME + FADE_STEP), SAMPLE_TIME);
+
+typedef narrowest_t<LONGEST_TIME * 2>::type ms_t;
+
+constexpr bool timeFits(uint32_t ms) {
+  return ms <= (ms_t)-1 / 2;
+}
+
+/***
+ * Auto-repeat profile of a held button. Entry k gives the points added by
+ * the k-th repeat and the wait before the next one, the last entry holds
+ * for as long as the button does. Waits are in PRESS_TICK units so the tick
+ * only subtracts them from the press timer.
+ */
+struct accel_t {
+  uint8_t ticks;
+  uint8_t step;
+};
+
+constexpr accel_t accel(uint16_t ms, uint8_t step) {
+  return { (uint8_t)ticksOf(ms, PRESS_TICK), step };
+}
+
+constexpr accel_t ACCEL[] PROGMEM = {
+  accel(REPEAT_TIME, 1), accel(REPEAT_TIME, 1), accel(150, 1), accel(150, 1),
+  accel(100, 1), accel(100, 2), accel(100, 2), accel(100, 3)
+};
+
+const uint8_t ACCEL_STAGES = sizeof(ACCEL) / sizeof(ACCEL[0]);
+
+// A press timer rewound by a repeat must not look like a new click or a fresh chord press
+constexpr bool accelFits(uint8_t k = 0) {
+  return (k >= ACCEL_STAGES) || ((ACCEL[k].ticks > 0) && (HOLD_TICKS - ACCEL[k].ticks >= MAX_DEBOUNCE_TICKS + CHORD_TICKS) && (ACCEL[k].step > 0) && accelFits(k + 1));
+}
+
+static_assert(accelFits(), "Repeat must not look like a new click or chord");
+
+/***
+ * All runtime state in 5 bytes:
+ * scores[i] - bits 0..6 score, bit 7 spare
+ * flags - bits 0..1 runstate, bits 2..4 brightness, bits 5..7 ACCEL stage of the held button
+ * pressed[i] - press timers in PRESS_TICK units, saturating
+ */
+struct state_t {
+  uint8_t scores[2];
+  uint8_t flags;
+  uint8_t pressed[2];
+};
+
+static_assert(sizeof(state_t) == 5, "state_t must stay packed");
+
+const uint8_t SCORE_MASK = 0x7F;
+const uint8_t RUNSTATE_MASK = 0x03;
+const uint8_t BRIGHTNESS_SHIFT = 2;
+const uint8_t BRIGHTNESS_MASK = 0x07 << BRIGHTNESS_SHIFT;
+const uint8_t REPEAT_SHIFT = 5;
+const uint8_t REPEAT_MASK = 0x07 << REPEAT_SHIFT;
+
+volatile state_t state = { { START_SCORE, START_SCORE }, RUN_IDLE | (DIM_BRIGHT << BRIGHTNESS_SHIFT), { 0, 0 } };
+volatile ms_t _ms = 0;
+volatile ms_t stateTime = 0;
+volatile uint8_t seq = 0; // Bumped by every ISR run, see snapshot()
+#if ENCODER
+volatile int8_t steps = 0; // Detents not yet applied, positive clockwise
+#endif
+#if KEYSCAN
+volatile uint8_t keys = 0; // Buttons down according to the last key scan
+uint8_t scanTime = 0; // Low byte of millis() of that scan
+#endif
+#if MATCH_MODE
+/***
+ * Finished sets of the match, oldest in bit 0: a set bit means the right
+ * player won it. Sets beyond the 16th are counted in the score only.
+ */
+const uint8_t MAX_SETS = 16;
+
+static_assert(MATCH_SETS * 2 - 1 <= MAX_SETS, "History must hold a whole match");
+
+volatile uint16_t history = 0;
+volatile uint8_t sets = 0; // Sets in history
+volatile bool historyAsked = false; // Set by the gesture, taken over by the main loop
+volatile bool historyShown = false; // Main loop only writes
+
+uint16_t EE_HISTORY EEMEM;
+uint8_t EE_SETS EEMEM;
+#endif
+
+#if CLOCK_MODE
+/***
+ * Time left per player in minutes, seconds and tenths, so the tick counts
+ * down without dividing a total; only showClock() splits them into digits.
+ * The RC oscillator is off by up to a few percent even after OSCCAL, so
+ * each PRESS_TICK adds clockTrim / 65536 ms on top to a fraction and the
+ * carries or borrows make up for it. A step of clockTrim is
+ * 1 / (65536 * PRESS_TICK), 7.6 ppm with the 2 ms tick (ISR only, except
+ * at boot).
+ */
+struct countdown_t {
+  uint8_t minutes;
+  uint8_t seconds;
+  uint8_t tenths;
+};
+
+volatile countdown_t clocks[2] = { { CLOCK_MINUTES, 0, 0 }, { CLOCK_MINUTES, 0, 0 } };
+volatile uint8_t turn = 0; // Player to move, whose clock runs in RUN_LEFT + turn
+uint8_t lastTurn = 0; // turn before the last click, for a chord to take it back
+uint8_t clockMs = 0; // Into the current tenth
+uint16_t clockFrac = 0;
+int16_t clockTrim = 0;
+
+uint8_t EE_OSCCAL EEMEM;
+uint16_t EE_TRIM EEMEM; // clockTrim
+#endif
+
+// What the renderer reads, taken in one consistent piece by snapshot()
+struct view_t {
+  uint8_t scores[2];
+  uint8_t flags;
+  ms_t uptime;
+  ms_t stateTime;
+#if MATCH_MODE
+  uint16_t history;
+  uint8_t sets;
+#endif
+#if CLOCK_MODE
+  uint8_t turn;
+  countdown_t countdown; // Of turn
+#endif
+};
+
+inline ms_t millis() {
   return _ms;
 }
 
+/***
+ * Timer0 settings that keep a 1 ms compare at a system clock of F_CPU >> clkps.
+ * Prefers the /64 prescaler of the full speed setup, then the others.
+ */
+constexpr uint16_t timerDiv(uint8_t cs) {
+  return cs == 1 ? 1 : cs == 2 ? 8 : cs == 3 ? 64 : cs == 4 ? 256 : 1024;
+}
+
+constexpr bool tickFits(uint8_t clkps, uint8_t cs) {
+  return ((F_CPU / 1000) % (timerDiv(cs) << clkps) == 0) && ((F_CPU / 1000) / (timerDiv(cs) << clkps) <= 256);
+}
+
+constexpr uint8_t tickCS(uint8_t clkps) {
+  return tickFits(clkps, 3) ? 3 : tickFits(clkps, 2) ? 2 : tickFits(clkps, 1) ? 1 : tickFits(clkps, 4) ? 4 : tickFits(clkps, 5) ? 5 : 0;
+}
+
+constexpr uint16_t tickCounts(uint8_t clkps) {
+  return (F_CPU / 1000) / (timerDiv(tickCS(clkps)) << clkps);
+}
+
+static_assert(tickCS(CLOCK_FULL) && tickCS(CLOCK_IDLE), "No Timer0 setting gives an exact 1 ms tick at this clock");
+
+// Switches the system clock and retunes Timer0 so millis() keeps its pace
+static inline void setClock(uint8_t clkps, uint8_t from) {
+  uint8_t sreg = SREG;
+
+  cli();
+  CLKPR = 1 << CLKPCE;
+  CLKPR = clkps;
+  TCCR0B = tickCS(clkps);
+  if (tickCounts(clkps) != tickCounts(from)) {
+    OCR0A = tickCounts(clkps) - 1;
+    TCNT0 = (uint16_t)TCNT0 * tickCounts(clkps) / tickCounts(from);
+  }
+  SREG = sreg;
+}
+
+// Accessors work on the live state and on a view_t copy alike
+template<typename S>
+static inline uint8_t getScore(S &s, uint8_t i) {
+  return s.scores[i] & SCORE_MASK;
+}
+
+template<typename S>
+static inline void setScore(S &s, uint8_t i, uint8_t value) {
+  s.scores[i] = (s.scores[i] & ~SCORE_MASK) | value;
+}
+
+template<typename S>
+static inline runstate_t getRunstate(S &s) {
+  return (runstate_t)(s.flags & RUNSTATE_MASK);
+}
+
+template<typename S>
+static inline uint8_t getBrightness(S &s) {
+  return (s.flags & BRIGHTNESS_MASK) >> BRIGHTNESS_SHIFT;
+}
+
+template<typename S>
+static inline uint8_t getRepeat(S &s) {
+  return (s.flags & REPEAT_MASK) >> REPEAT_SHIFT;
+}
+
+template<typename S>
+static inline void setRepeat(S &s, uint8_t stage) {
+  s.flags = (s.flags & ~REPEAT_MASK) | (stage << REPEAT_SHIFT);
+}
+
+// Run state and brightness always change together
+template<typename S>
+static inline void setRunstate(S &s, runstate_t runstate, uint8_t brightness) {
+  s.flags = (s.flags & ~(RUNSTATE_MASK | BRIGHTNESS_MASK)) | runstate | (brightness << BRIGHTNESS_SHIFT);
+}
+
+/***
+ * The ISR is the only writer and cannot be interrupted by the main loop, so a
+ * copy is consistent if seq did not move while it was taken. A retry costs a
+ * few microseconds once per tick at worst, and interrupts stay enabled.
+ */
+static void snapshot(view_t &view) {
+  uint8_t before;
+
+  do {
+    before = seq;
+    view.scores[0] = state.scores[0];
+    view.scores[1] = state.scores[1];
+    view.flags = state.flags;
+    view.uptime = _ms;
+    view.stateTime = stateTime;
+#if MATCH_MODE
+    view.history = history;
+    view.sets = sets;
+#endif
+#if CLOCK_MODE
+    view.turn = turn;
+    view.countdown.minutes = clocks[turn].minutes;
+    view.countdown.seconds = clocks[turn].seconds;
+    view.countdown.tenths = clocks[turn].tenths;
+#endif
+  } while (seq != before);
+}
+
+#if STACK_PAINT
+const uint8_t STACK_CANARY = 0xC5;
+
+extern uint8_t _end; // First byte after .bss
+extern uint8_t __stack; // RAMEND
+
+// Runs from .init1, before __zero_reg__ and SP are set up, so no C here
+void paintStack() __attribute__((naked, used, section(".init1")));
+void paintStack() {
+  asm volatile (
+    "ldi r30, lo8(_end)\n"
+    "ldi r31, hi8(_end)\n"
+    "ldi r24, %0\n"
+    "ldi r25, hi8(__stack + 1)\n"
+    "1: st Z+, r24\n"
+    "cpi r30, lo8(__stack + 1)\n"
+    "cpc r31, r25\n"
+    "brlo 1b\n"
+    : : "M" (STACK_CANARY)
+  );
+}
+
+volatile bool stackShown = false; // Toggled by the chord
+
+// Bytes between .bss and the deepest stack write so far
+static uint8_t stackFree() {
+  const uint8_t *p = &_end;
+
+  while ((p <= &__stack) && (*p == STACK_CANARY))
+    ++p;
+  return p - &_end;
+}
+#endif
+
+// Bit i is set while button i is down
+static inline uint8_t readButtons() {
+#if KEYSCAN
+  return keys;
+#else
+  uint8_t pinb = PINB;
+
+#if ENCODER
+  return pinb & (1 << BTN_PINS[0]) ? 0 : 0x01;
+#else
+  return (pinb & (1 << BTN_PINS[0]) ? 0 : 0x01) | (pinb & (1 << BTN_PINS[1]) ? 0 : 0x02);
+#endif
+#endif
+}
+
+#if BUZZER
+/***
+ * Tones come from Timer0 itself: OC0A toggles on every compare match and
+ * OCR0A holds the half period, so the tick ISR runs at twice the pitch
+ * while a note plays and counts whole milliseconds out of timer counts.
+ * Both system clocks run Timer0 at the same rate, so setClock() never
+ * touches OCR0A here.
+ */
+const uint8_t TICK_COUNTS = tickCounts(CLOCK_IDLE);
+
+static_assert(tickCounts(CLOCK_FULL) == TICK_COUNTS, "Tones need the same Timer0 rate at both clocks");
+
+struct note_t {
+  uint8_t half; // Timer counts per half period, 0 - rest
+  uint8_t ms; // 0 - end of tune
+};
+
+// 293 Hz and up fit the 8-bit timer
+constexpr note_t note(uint16_t hz, uint8_t ms) {
+  return { (uint8_t)(hz ? TICK_COUNTS * 1000UL / 2 / hz : 0), ms };
+}
+
+const note_t TUNES[] PROGMEM = {
+  note(2000, 15), note(0, 0), // TUNE_CLICK
+  note(1000, 80), note(0, 40), note(1000, 80), note(0, 40), note(2000, 160), note(0, 0) // TUNE_LIMIT
+};
+
+const uint8_t TUNE_CLICK = 0;
+const uint8_t TUNE_LIMIT = 2;
+
+uint16_t toneCounts = 0; // Timer counts since the last whole ms (ISR only)
+uint8_t tune = 0; // Next note in TUNES
+uint8_t noteLeft = 0; // ms left of the current note, 0 - silent
+
+// Starts TUNES[tune] or stops at the end of the tune
+static inline void nextNote() {
+  uint8_t half = pgm_read_byte(&TUNES[tune].half);
+
+  noteLeft = pgm_read_byte(&TUNES[tune].ms);
+  ++tune;
+  if (noteLeft && half) {
+    OCR0A = half - 1;
+    TCCR0A = (1 << WGM01) | (1 << COM0A0); // Toggle OC0A
+  } else { // Rest or end, the pin falls back to PORTB (low)
+    OCR0A = TICK_COUNTS - 1;
+    TCCR0A = 1 << WGM01;
+  }
+}
+
+static inline void play(uint8_t start) {
+  tune = start;
+  nextNote();
+}
+#endif
+
+/***
+ * 7-segment font, built at compile time. Bits 0..6 are segments A..G,
+ * bit 7 is the colon/dot. Letters without a sensible shape are blank.
+ */
+const uint8_t SEG_A = 0x01;
+const uint8_t SEG_B = 0x02;
+const uint8_t SEG_C = 0x04;
+const uint8_t SEG_D = 0x08;
+const uint8_t SEG_E = 0x10;
+const uint8_t SEG_F = 0x20;
+const uint8_t SEG_G = 0x40;
+const uint8_t DOT = 0x80;
+
+constexpr uint8_t glyph(char c) {
+  return c == '0' || c == 'O' || c == 'D' ? SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F :
+    c == '1' ? SEG_B | SEG_C :
+    c == '2' || c == 'Z' ? SEG_A | SEG_B | SEG_D | SEG_E | SEG_G :
+    c == '3' ? SEG_A | SEG_B | SEG_C | SEG_D | SEG_G :
+    c == '4' ? SEG_B | SEG_C | SEG_F | SEG_G :
+    c == '5' || c == 'S' ? SEG_A | SEG_C | SEG_D | SEG_F | SEG_G :
+    c == '6' ? SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G :
+    c == '7' ? SEG_A | SEG_B | SEG_C :
+    c == '8' || c == 'B' ? SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G :
+    c == '9' || c == 'g' ? SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G :
+    c == 'A' ? SEG_A | SEG_B | SEG_C | SEG_E | SEG_F | SEG_G :
+    c == 'b' ? SEG_C | SEG_D | SEG_E | SEG_F | SEG_G :
+    c == 'C' ? SEG_A | SEG_D | SEG_E | SEG_F :
+    c == 'c' ? SEG_D | SEG_E | SEG_G :
+    c == 'd' ? SEG_B | SEG_C | SEG_D | SEG_E | SEG_G :
+    c == 'E' ? SEG_A | SEG_D | SEG_E | SEG_F | SEG_G :
+    c == 'F' ? SEG_A | SEG_E | SEG_F | SEG_G :
+    c == 'G' ? SEG_A | SEG_C | SEG_D | SEG_E | SEG_F :
+    c == 'H' ? SEG_B | SEG_C | SEG_E | SEG_F | SEG_G :
+    c == 'h' ? SEG_C | SEG_E | SEG_F | SEG_G :
+    c == 'I' ? SEG_E | SEG_F :
+    c == 'i' ? SEG_E :
+    c == 'J' ? SEG_B | SEG_C | SEG_D | SEG_E :
+    c == 'L' ? SEG_D | SEG_E | SEG_F :
+    c == 'n' ? SEG_C | SEG_E | SEG_G :
+    c == 'o' ? SEG_C | SEG_D | SEG_E | SEG_G :
+    c == 'P' ? SEG_A | SEG_B | SEG_E | SEG_F | SEG_G :
+    c == 'q' ? SEG_A | SEG_B | SEG_C | SEG_F | SEG_G :
+    c == 'r' ? SEG_E | SEG_G :
+    c == 't' ? SEG_D | SEG_E | SEG_F | SEG_G :
+    c == 'U' ? SEG_B | SEG_C | SEG_D | SEG_E | SEG_F :
+    c == 'u' || c == 'v' ? SEG_C | SEG_D | SEG_E :
+    c == 'y' ? SEG_B | SEG_C | SEG_D | SEG_F | SEG_G :
+    c == '-' ? SEG_G :
+    c == '_' ? SEG_D :
+    c == '.' ? DOT : 0;
+}
+
+const uint8_t DIGITS[10] PROGMEM = {
+  glyph('0'), glyph('1'), glyph('2'), glyph('3'), glyph('4'), glyph('5'), glyph('6'), glyph('7'), glyph('8'), glyph('9')
+};
+
+const uint8_t MINUS = glyph('-');
+
+static_assert(glyph('7') == 0B0000111, "Font must match the old digit table");
+
+#if ANIMATIONS
+/***
+ * Keyframes of all animations back to back in flash, each one ends with a
+ * frame of 0 ms. Times are in 4 ms units so the engine shifts instead of
+ * multiplying (no MUL on the ATtiny13) and a frame lasts up to 1 sec.
+ */
+const uint8_t FRAME_SHIFT = 2;
+
+struct frame_t {
+  uint8_t segments[4];
+  uint8_t time;
+};
+
+constexpr frame_t frame(const char *text, uint16_t ms) {
+  return { { glyph(text[0]), glyph(text[1]), glyph(text[2]), glyph(text[3]) }, (uint8_t)(ms >> FRAME_SHIFT) };
+}
+
+const frame_t FRAMES[] PROGMEM = {
+  frame("OvEr", 400), frame("    ", 200), frame("OvEr", 400), frame("    ", 200), frame("OvEr", 800), frame("    ", 0), // ANIM_OVER
+  frame("   r", 120), frame("  rE", 120), frame(" rES", 120), frame("rESE", 120), frame("ESEt", 120), frame("SEt ", 120),
+  frame("Et  ", 120), frame("t   ", 120), frame("    ", 0), // ANIM_RESET
+  frame("SEt ", 300), frame("    ", 150), frame("SEt ", 300), frame("    ", 150), frame("SEt ", 600), frame("    ", 0) // ANIM_SET
+};
+
+static_assert(sizeof(FRAMES) / sizeof(FRAMES[0]) < 0xFF, "Frame indexes are 8-bit");
+
+const uint8_t ANIM_OVER = 0;
+const uint8_t ANIM_RESET = 6;
+const uint8_t ANIM_SET = 15;
+const uint8_t NO_ANIMATION = 0xFF;
+
+volatile uint8_t animate = NO_ANIMATION; // Animation asked for by the ISR, taken over by the main loop
+uint8_t keyframe = NO_ANIMATION; // Frame on the display (main loop only)
+ms_t frameTime; // millis() it went up
+#endif
+
+#if UNDO
+/***
+ * Ring of the last UNDO_DEPTH score changes, one byte each: bit 7 player,
+ * bits 0..6 the signed delta. 0 marks a reset, whose scores are kept
+ * aside, so only the latest reset can be taken back and a new one drops the
+ * entries up to an older one. Older entries are overwritten, undo only ever
+ * steps back from the head (ISR only).
+ */
+const uint8_t UNDO_DEPTH = 4;
+
+static_assert(UNDO_DEPTH && ! (UNDO_DEPTH & (UNDO_DEPTH - 1)), "Undo depth must be a power of 2");
+
+constexpr bool stepsFit(uint8_t k = 0) {
+  return (k >= ACCEL_STAGES) || ((ACCEL[k].step < 0x40) && stepsFit(k + 1));
+}
+
+static_assert(stepsFit(), "Score steps must fit the 7-bit delta");
+
+const uint8_t UNDO_RESET = 0;
+
+uint8_t undoLog[UNDO_DEPTH];
+uint8_t undoHead = 0; // Next entry to write
+uint8_t undoCount = 0; // Entries that can be taken back
+uint8_t undoScores[2]; // Scores before the last reset
+bool stray = false; // The press being accepted changed a score (ISR only)
+
+static inline void logChange(uint8_t entry) {
+  undoLog[undoHead] = entry;
+  undoHead = (undoHead + 1) & (UNDO_DEPTH - 1);
+  if (undoCount < UNDO_DEPTH)
+    ++undoCount;
+  stray = true;
+}
+
+// Reverts the newest entry and shows the side it touched
+static void undo() {
+  uint8_t entry;
+
+  if (! undoCount)
+    return;
+  --undoCount;
+  undoHead = (undoHead - 1) & (UNDO_DEPTH - 1);
+  entry = undoLog[undoHead];
+  if (entry == UNDO_RESET) {
+    setScore(state, 0, undoScores[0]);
+    setScore(state, 1, undoScores[1]);
+    setRunstate(state, RUN_IDLE, DIM_BRIGHT);
+  } else {
+    uint8_t i = entry >> 7;
+
+    setScore(state, i, getScore(state, i) - ((int8_t)(entry << 1) >> 1));
+    setRunstate(state, (runstate_t)(RUN_LEFT + i), NORMAL_BRIGHT);
+  }
+  stateTime = millis();
+}
+#endif
+
+#if MATCH_MODE
+// Sets player i has won of the first count in bits
+static uint8_t setsWon(uint16_t bits, uint8_t count, uint8_t i) {
+  uint8_t won = 0;
+
+  for (uint8_t k = count; k; --k) {
+    won += bits & 0x01;
+    bits >>= 1;
+  }
+  return i ? won : count - won;
+}
+
+// A player has won MATCH_SETS of the first count sets in bits
+static bool matchWon(uint16_t bits, uint8_t count) {
+  return (setsWon(bits, count, 0) >= MATCH_SETS) || (setsWon(bits, count, 1) >= MATCH_SETS);
+}
+
+// After a point of player i: closes the set if the rules say it is won
+static inline void checkSet(uint8_t i) {
+  uint8_t score = getScore(state, i);
+
+  if ((score >= SET_POINTS) && (score >= getScore(state, i ^ 1) + WIN_BY)) {
+    if (sets < MAX_SETS) {
+      if (i)
+        history |= (uint16_t)1 << sets;
+      ++sets;
+    }
+    setScore(state, 0, 0);
+    setScore(state, 1, 0);
+#if UNDO
+    undoCount = 0; // A closed set stays closed
+#endif
+#if ANIMATIONS
+    animate = matchWon(history, sets) ? ANIM_OVER : ANIM_SET;
+#endif
+  }
+}
+#endif
+
+// Both buttons pressed, reset score (and start a new match)
+static inline void resetScores() {
+#if UNDO && MATCH_MODE
+  undoCount = 0;
+#elif UNDO
+  for (uint8_t k = 0; k < undoCount; ++k) { // The older reset lost its scores
+    if (undoLog[(undoHead - 1 - k) & (UNDO_DEPTH - 1)] == UNDO_RESET) {
+      undoCount = k;
+      break;
+    }
+  }
+  undoScores[0] = getScore(state, 0);
+  undoScores[1] = getScore(state, 1);
+  logChange(UNDO_RESET);
+#endif
+  setScore(state, 0, START_SCORE);
+  setScore(state, 1, START_SCORE);
+  setRunstate(state, RUN_IDLE, DIM_BRIGHT);
+#if MATCH_MODE
+  history = 0;
+  sets = 0;
+#endif
+#if ANIMATIONS
+  animate = ANIM_RESET;
+#endif
+}
+
+// Click or repeat of button i: selects a side when idle, then steps its score
+static inline void click(uint8_t i, uint8_t step = 1) {
+  runstate_t runstate = getRunstate(state);
+
+#if MATCH_MODE
+  if (matchWon(history, sets)) { // Only lights the result up until a new match
+    setRunstate(state, RUN_IDLE, NORMAL_BRIGHT);
+    stateTime = millis();
+    return;
+  }
+#endif
+  if ((runstate == RUN_IDLE) || (runstate == RUN_BLANK)) {
+    setRunstate(state, (runstate_t)(RUN_LEFT + i), NORMAL_BRIGHT);
+  } else {
+    uint8_t score = getScore(state, runstate - RUN_LEFT);
+#if UNDO
+    uint8_t before = score;
+#endif
+
+    if (i) { // +
+      score = score < 99 - step ? score + step : 99;
+    } else { // -
+      score = score > step ? score - step : 0;
+    }
+#if ANIMATIONS && ! MATCH_MODE
+    if ((! score) && (getScore(state, runstate - RUN_LEFT) != score)) // Just ran out, not on every "-" at 0
+      animate = ANIM_OVER;
+#endif
+    setScore(state, runstate - RUN_LEFT, score);
+#if UNDO
+    if (score != before)
+      logChange(((runstate - RUN_LEFT) << 7) | ((score - before) & 0x7F));
+#endif
+#if MATCH_MODE
+    if (i)
+      checkSet(runstate - RUN_LEFT);
+#endif
+#if BUZZER
+    play((score == 0) || (score == MAX_SCORE) ? TUNE_LIMIT : TUNE_CLICK);
+#endif
+  }
+  stateTime = millis();
+}
+
+#if CLOCK_MODE
+template<typename C>
+static inline bool clockOut(C &c) {
+  return ! (c.minutes | c.seconds | c.tenths);
+}
+
+// Button i ends the move of player i and starts the other clock
+static inline void clockClick(uint8_t i) {
+  lastTurn = turn;
+  if (clockOut(clocks[0]) || clockOut(clocks[1])) { // Game over, only lights the result up again
+    setRunstate(state, RUN_IDLE, NORMAL_BRIGHT);
+    stateTime = millis();
+    return;
+  }
+  if (getRunstate(state) == RUN_LEFT + (i ^ 1))
+    return;
+  turn = i ^ 1;
+  setRunstate(state, (runstate_t)(RUN_LEFT + turn), NORMAL_BRIGHT);
+  stateTime = millis();
+}
+
+static inline void pauseClock() {
+  setRunstate(state, RUN_IDLE, DIM_BRIGHT);
+  stateTime = millis();
+}
+
+static inline void resetClocks() {
+  for (uint8_t i = 0; i < 2; ++i) {
+    clocks[i].minutes = CLOCK_MINUTES;
+    clocks[i].seconds = 0;
+    clocks[i].tenths = 0;
+  }
+  turn = 0;
+  pauseClock();
+#if ANIMATIONS
+  animate = ANIM_RESET;
+#endif
+}
+
+// PRESS_TICK of the running clock, stops it at 0
+static inline void tickClock() {
+  volatile countdown_t &c = clocks[turn];
+  uint16_t frac = clockFrac;
+  uint8_t ms = clockMs + PRESS_TICK;
+
+  clockFrac = frac + clockTrim;
+  if ((clockTrim > 0) && (clockFrac < frac))
+    ++ms;
+  else if ((clockTrim < 0) && (clockFrac > frac))
+    --ms;
+  if (ms >= 100) {
+    ms -= 100;
+    if (c.tenths) {
+      --c.tenths;
+    } else if (c.seconds) {
+      --c.seconds;
+      c.tenths = 9;
+    } else if (c.minutes) {
+      --c.minutes;
+      c.seconds = 59;
+      c.tenths = 9;
+    }
+    if (clockOut(c)) { // Flag fell
+      setRunstate(state, RUN_IDLE, NORMAL_BRIGHT);
+      stateTime = millis();
+#if BUZZER
+      play(TUNE_LIMIT);
+#endif
+    }
+  }
+  clockMs = ms;
+}
+#endif
+
+#if CALIBRATE
+volatile bool calibrateMark = false; // "+" clicked, taken over by the main loop
+#endif
+
+#if ADAPTIVE_DEBOUNCE
+/***
+ * A press is an episode from its first closed sample until the contact has
+ * stayed open for a whole window. Its bounce is the time from that first
+ * sample to the start of the stable run that got it accepted, including
+ * any chatter long enough to be accepted twice.
+ */
+struct bounce_t {
+  uint8_t window; // Debounce in PRESS_TICK units
+  uint8_t age; // Ticks since the episode started, 0 - no episode
+  uint8_t closed; // age at the last closed sample
+};
+
+volatile bounce_t bounce[2] = { { DEBOUNCE_TICKS, 0, 0 }, { DEBOUNCE_TICKS, 0, 0 } };
+volatile uint8_t accepted = 0; // Bit i - button i already counted in this episode
+
+#if DEBOUNCE_EEPROM
+uint8_t EE_DEBOUNCE[2] EEMEM;
+
+const uint8_t DEBOUNCE_DRIFT = 2; // Window change in PRESS_TICK units that is worth an EEPROM write
+#endif
+
+static inline void trackBounce(uint8_t i, bool down) {
+  volatile bounce_t &b = bounce[i];
+
+  if (b.age && (b.age < 0xFF))
+    ++b.age;
+  if (down) {
+    if (! b.age)
+      b.age = 1;
+    b.closed = b.age;
+  } else if (b.age && ((b.age == 0xFF) || ((uint8_t)(b.age - b.closed) >= b.window))) { // Released for good
+    b.age = 0;
+    accepted &= ~(1 << i);
+  }
+}
+
+/***
+ * Called when button i has been closed for its window. A window that was
+ * too short jumps up at once, a clean press lets it creep down by one tick.
+ * Returns false for chatter inside an episode that was already counted.
+ */
+static inline bool acceptPress(uint8_t i) {
+  volatile bounce_t &b = bounce[i];
+  uint8_t observed = b.age - b.window;
+  uint8_t target = observed < MAX_DEBOUNCE_TICKS ? observed + (observed >> 1) + MIN_DEBOUNCE_TICKS : MAX_DEBOUNCE_TICKS;
+
+  if (target > MAX_DEBOUNCE_TICKS)
+    target = MAX_DEBOUNCE_TICKS;
+  if (target > b.window)
+    b.window = target;
+  else if (b.window > target)
+    --b.window;
+  if (accepted & (1 << i))
+    return false;
+  accepted |= 1 << i;
+  return true;
+}
+
+static inline uint8_t debounceTicks(uint8_t i) {
+  return bounce[i].window;
+}
+#else
+static inline bool acceptPress(uint8_t) {
+  return true;
+}
+
+static inline uint8_t debounceTicks(uint8_t) {
+  return DEBOUNCE_TICKS;
+}
+#endif
+
+/***
+ * Gestures, recognized in the tick from the press timers:
+ * G_CLICK - press accepted, reported at once so a tap costs no extra latency
+ * G_DOUBLE - press within DOUBLE_TIME of the last release, instead of G_CLICK
+ * G_HOLD - held for HOLD_TIME
+ * G_REPEAT - held on, paced and sized by ACCEL
+ * G_CHORD - second button accepted within CHORD_TIME of the first, which
+ *   has already reported its G_CLICK, and both released before HOLD_TIME.
+ *   Both buttons stay in the chord and report nothing else until released
+ * G_CHORD_HOLD - both chord buttons held for HOLD_TIME, instead of G_CHORD
+ */
+enum gesture_t : uint8_t { G_CLICK, G_DOUBLE, G_HOLD, G_REPEAT, G_CHORD, G_CHORD_HOLD };
+
+uint8_t released[2] = { 0xFF, 0xFF }; // Ticks since each button was let go, saturating (ISR only)
+
+const uint8_t CHORD_TAP = 1;
+const uint8_t CHORD_HELD = 2;
+
+uint8_t chord = 0; // Buttons down are part of a chord, CHORD_TAP until held (ISR only)
+
+// What the scoreboard does with a gesture of button i (the later one for chords)
+static inline void gesture(gesture_t g, uint8_t i, uint8_t step = 1) {
+#if STACK_PAINT
+  if ((g == G_CHORD) || (g == G_CHORD_HOLD)) { // Reading the stack must not reset the game
+    if (g == G_CHORD)
+      stackShown = ! stackShown;
+    return;
+  }
+#endif
+#if CALIBRATE
+  if ((g == G_CLICK) && i) {
+    setRunstate(state, RUN_LEFT, NORMAL_BRIGHT); // Kept on until the next reset
+    calibrateMark = true;
+  }
+  (void)step;
+#elif CLOCK_MODE
+  if ((g == G_CLICK) || (g == G_DOUBLE))
+    clockClick(i);
+  else if (g == G_CHORD_HOLD) // A tap has paused already
+    resetClocks();
+  (void)step;
+#else
+  switch (g) {
+    case G_CLICK:
+    case G_DOUBLE: // Quick taps all count
+    case G_HOLD:
+    case G_REPEAT:
+      click(i, step);
+      break;
+    case G_CHORD:
+#if UNDO
+      undo();
+#else
+      resetScores();
+#endif
+      break;
+    case G_CHORD_HOLD:
+#if MATCH_MODE
+      if (! historyShown) { // Held again while the history is up, a new match
+        historyAsked = true;
+        break;
+      }
+#endif
+      resetScores();
+      break;
+    default:
+      break;
+  }
+#endif
+}
+
+#if ENCODER
+/***
+ * Every edge on A or B lands here, so fast spins are not limited by the
+ * 2 ms button tick. The table turns (old AB, new AB) into -1, 0 or +1 and
+ * ignores the invalid double transitions, so a bouncing contact only moves
+ * back and forth around the same position.
+ */
+ISR(PCINT0_vect) {
+  static const int8_t QUADRATURE[16] PROGMEM = {
+    0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0
+  };
+
+  static uint8_t ab = 0x03; // Both channels pulled up at rest
+  static int8_t count = 0;
+
+  uint8_t pinb = PINB;
+
+  ab = ((ab << 2) | (pinb & (1 << ENC_PINS[0]) ? 0x02 : 0) | (pinb & (1 << ENC_PINS[1]) ? 0x01 : 0)) & 0x0F;
+  count += (int8_t)pgm_read_byte(&QUADRATURE[ab]);
+  if (count >= ENC_STEPS) {
+    count = 0;
+    ++steps;
+  } else if (count <= -ENC_STEPS) {
+    count = 0;
+    --steps;
+  }
+}
+#endif
+
+#if INPUT_BACKEND == INPUT_HYBRID
+EMPTY_INTERRUPT(PCINT0_vect); // Only wakes the chip up
+#endif
+
 ISR(TIM0_COMPA_vect) {
-  static uint16_t pressedTime[2] = { 0, 0 };
+  uint8_t buttons;
 
-  uint8_t pinb;
+#if BUZZER
+  toneCounts += OCR0A + 1; // Period that just ended, nextNote() changes OCR0A only right after a match
+  if (toneCounts < TICK_COUNTS)
+    return;
+  toneCounts -= TICK_COUNTS;
+  if (noteLeft && (! --noteLeft))
+    nextNote();
+#endif
+  ++seq;
+  if (++_ms & (PRESS_TICK - 1))
+    return;
+  switch (getRunstate(state)) {
+    case RUN_LEFT:
+    case RUN_RIGHT:
+#if CLOCK_MODE
+      if (! CALIBRATE) // A running clock keeps the side selected, and so does calibration
+        tickClock();
+#else
+      if ((ms_t)(_ms - stateTime) >= STATE_DURATION)
+        setRunstate(state, RUN_IDLE, DIM_BRIGHT);
+#endif
+      break;
+    case RUN_IDLE: // Fade out, stateTime moves on by a step per level
+      if ((ms_t)(_ms - stateTime) >= FADE_TIME) {
+        uint8_t brightness = getBrightness(state);
 
-  ++_ms;
-  pinb = PINB;
+        stateTime += FADE_STEP;
+        if (brightness)
+          setRunstate(state, RUN_IDLE, brightness - 1);
+        else
+          setRunstate(state, RUN_BLANK, 0);
+      }
+      break;
+    default:
+      break;
+  }
+  buttons = readButtons();
   for (uint8_t i = 0; i < 2; ++i) {
-    if (! (pinb & (1 << BTN_PINS[i]))) { // Button pressed
-      if (pressedTime[i] < 0xFFFF)
-        ++pressedTime[i];
-      if (pressedTime[i] >= DEBOUNCE_TIME) {
-        if (i && (pressedTime[0] >= DEBOUNCE_TIME)) { // Both buttons pressed, reset score
-          score[0] = score[1] = MAX_SCORE;
-          runstate = RUN_IDLE;
-          brightness = DIM_BRIGHT;
-        } else {
-          if ((pressedTime[i] == DEBOUNCE_TIME) || ((pressedTime[i] >= HOLD_TIME) && ((pressedTime[i] - HOLD_TIME) % REPEAT_TIME == 0))) { // Click
-            if (runstate == RUN_IDLE) {
-              runstate = (runstate_t)(RUN_LEFT + i);
-              brightness = NORMAL_BRIGHT;
-            } else {
-              if (i) { // +
-                if (score[runstate - RUN_LEFT] < 99)
-                  ++score[runstate - RUN_LEFT];
-              } else { // -
-                if (score[runstate - RUN_LEFT])
-                  --score[runstate - RUN_LEFT];
-              }
-            }
-            stateTime = millis();
-          }
+#if ADAPTIVE_DEBOUNCE
+    trackBounce(i, buttons & (1 << i));
+#endif
+    if (buttons & (1 << i)) { // Button pressed
+      uint8_t pressed = state.pressed[i];
+      uint8_t other = state.pressed[i ^ 1];
+
+      if (pressed < 0xFF)
+        state.pressed[i] = ++pressed;
+      if (chord) {
+        if ((pressed == HOLD_TICKS) && (other >= HOLD_TICKS)) { // The later of the two
+          chord = CHORD_HELD;
+          gesture(G_CHORD_HOLD, i);
+        }
+      } else if (pressed == debounceTicks(i)) {
+        if (! acceptPress(i)) // Chatter of a press already counted
+          continue;
+        if ((other >= debounceTicks(i ^ 1)) && (other < pressed + CHORD_TICKS)) {
+          chord = CHORD_TAP;
+#if UNDO
+          if (stray) // The first button of the chord was not meant as a click
+            undo();
+#endif
+#if CLOCK_MODE && ! CALIBRATE
+          turn = lastTurn; // Same for the clock the first button started,
+          pauseClock(); // which stops at once rather than on release
+#endif
+        } else { // A new press starts the ACCEL profile over
+          setRepeat(state, 0);
+#if UNDO
+          stray = false;
+#endif
+          gesture(released[i] < DOUBLE_TICKS ? G_DOUBLE : G_CLICK, i);
         }
+      } else if (pressed >= HOLD_TICKS) { // Next repeat as ACCEL says
+        uint8_t stage = getRepeat(state);
+
+        state.pressed[i] = pressed - pgm_read_byte(&ACCEL[stage].ticks);
+        if (stage < ACCEL_STAGES - 1)
+          setRepeat(state, stage + 1);
+        gesture(stage ? G_REPEAT : G_HOLD, i, pgm_read_byte(&ACCEL[stage].step));
       }
     } else { // Button released
-      pressedTime[i] = 0;
+      if (state.pressed[i] >= debounceTicks(i))
+        released[i] = 0;
+      else if (released[i] < 0xFF)
+        ++released[i];
+      state.pressed[i] = 0;
+      if (chord && (! state.pressed[i ^ 1])) { // Both up, the chord is over
+        if (chord == CHORD_TAP)
+          gesture(G_CHORD, i);
+        chord = 0;
+      }
     }
   }
+#if ENCODER
+  // A detent is a click of "+" or "-", turning up with "-" held is the reset chord
+  for (; steps > 0; --steps) {
+    if (state.pressed[0] >= debounceTicks(0)) {
+#if UNDO
+      if (stray) { // Same as the button chord, the held "-" was not meant as a click
+        undo();
+        stray = false;
+      }
+#endif
+      gesture(G_CHORD, 1);
+    } else {
+      gesture(G_CLICK, 1);
+    }
+  }
+  for (; steps < 0; ++steps)
+    gesture(G_CLICK, 0);
+#endif
 }
 
 static inline void _bitDelay() {
@@ -92,7 +1281,7 @@ static void _stop() {
   PORTB |= (1 << TM_DIO_PIN);
 }
 
-static void _writeByte(uint8_t data) {
+static bool _writeByte(uint8_t data) {
   for (uint8_t i = 0; i < 8; ++i) {
 //    digitalWrite(TM_CLK_PIN, LOW);
     PORTB &= ~(1 << TM_CLK_PIN);
@@ -116,7 +1305,9 @@ static void _writeByte(uint8_t data) {
   PORTB &= ~(1 << TM_DIO_PIN);
   _bitDelay();
 //  if (! digitalRead(TM_DIO_PIN)) {
-  if (! ((PINB >> TM_DIO_PIN) & 0x01)) {
+  bool ack = ! ((PINB >> TM_DIO_PIN) & 0x01);
+
+  if (ack) {
 //    pinMode(TM_DIO_PIN, OUTPUT);
     DDRB |= (1 << TM_DIO_PIN);
 //    digitalWrite(TM_DIO_PIN, LOW);
@@ -126,25 +1317,347 @@ static void _writeByte(uint8_t data) {
 //  pinMode(TM_DIO_PIN, OUTPUT);
   DDRB |= (1 << TM_DIO_PIN);
   _bitDelay();
+  return ack;
 }
 
-static void display(const uint8_t *segments) {
-  const uint8_t ADDR_AUTO = 0x40;
-  const uint8_t STARTADDR = 0xC0;
+#if KEYSCAN
+/***
+ * Scan code is 0xFF with no key down. Otherwise bit 4 (K1) or bit 3 (K2) is
+ * cleared and bits 5..7 hold the SG line, inverted and bit reversed.
+ */
+static uint8_t _readKeys() {
+  const uint8_t READ_KEYS = 0x42;
+
+  uint8_t code = 0;
 
   _start();
-  _writeByte(ADDR_AUTO);
-  _stop();
-  _start();
-  _writeByte(STARTADDR);
-  for (int8_t i = 0; i < 4; ++i) {
-    _writeByte(segments[i]);
+  _writeByte(READ_KEYS);
+  DDRB &= ~(1 << TM_DIO_PIN); // The chip drives DIO from the next falling CLK on
+  for (uint8_t i = 0; i < 8; ++i) {
+    PORTB &= ~(1 << TM_CLK_PIN);
+    _bitDelay();
+    PORTB |= (1 << TM_CLK_PIN);
+    code >>= 1;
+    if (PINB & (1 << TM_DIO_PIN))
+      code |= 0x80;
   }
+  PORTB &= ~(1 << TM_CLK_PIN); // ACK
+  DDRB |= (1 << TM_DIO_PIN);
+  _bitDelay();
+  PORTB |= (1 << TM_CLK_PIN);
+  _bitDelay();
   _stop();
-  _start();
-  _writeByte(0x88 | brightness);
-  _stop();
+  return code;
+}
+
+// Buttons behind the key currently down, see KEYMAP
+static uint8_t scanKeys() {
+  uint8_t code;
+  uint8_t sg;
+
+  setClock(CLOCK_FULL, CLOCK_IDLE);
+  code = _readKeys();
+  setClock(CLOCK_IDLE, CLOCK_FULL);
+  if ((code & 0x18) == 0x18) // No key
+    return 0;
+  sg = (((code >> 7) & 0x01) | ((code >> 5) & 0x02) | ((code >> 3) & 0x04)) ^ 0x07;
+  return pgm_read_byte(&KEYMAP[code & 0x10 ? sg + 8 : sg]);
+}
+#endif
+
+#if LIGHT_SENSOR || BATTERY_MONITOR
+/***
+ * 8-bit conversions (ADLAR) of the ADMUX channel and reference in admux,
+ * taken in ADC noise reduction sleep with the ADC powered only meanwhile.
+ * The last of count results is returned, earlier ones let a freshly
+ * selected reference settle. Timer0 stops during that sleep, so millis()
+ * falls behind by 0.2 ms for the first conversion and 0.1 ms for others.
+ */
+static uint8_t adcRead(uint8_t admux, uint8_t count = 1) {
+  ADMUX = admux | (1 << ADLAR);
+  ADCSRA = (1 << ADEN) | (1 << ADIE) | (1 << ADPS1) | (1 << ADPS0); // 1.2 MHz / 8
+  set_sleep_mode(SLEEP_MODE_ADC);
+  do {
+    do {
+      sleep_mode(); // Starts a conversion, a pin change may wake up early
+    } while (ADCSRA & (1 << ADSC));
+  } while (--count);
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  ADCSRA = 0;
+  return ADCH;
+}
+
+EMPTY_INTERRUPT(ADC_vect);
+#endif
+
+#if LIGHT_SENSOR
+uint16_t light = 128 << 3; // Filtered reading, 8 times the average
+uint8_t lightLevel = NORMAL_BRIGHT; // 0..7, the reading in 32 wide bands
+ms_t lightTime = 0; // millis() of the last sample
+
+static void senseLight() {
+  uint8_t average;
+
+  light += adcRead(LIGHT_MUX) - (light >> 3); // Each sample weighs 1/8
+  average = light >> 3;
+  if ((average >= ((lightLevel + 1) << 5) + LIGHT_HYSTERESIS) || (average + LIGHT_HYSTERESIS < (lightLevel << 5)))
+    lightLevel = average >> 5;
+}
+
+// NORMAL_BRIGHT becomes the light level, the others keep their distance to it
+static uint8_t ambient(uint8_t brightness) {
+  int8_t level = brightness + lightLevel - NORMAL_BRIGHT;
+
+  return level < 0 ? 0 : (level > 7 ? 7 : level);
+}
+#else
+static inline uint8_t ambient(uint8_t brightness) {
+  return brightness;
+}
+#endif
+
+#if BATTERY_MONITOR
+bool lowBattery = false;
+ms_t batteryTime = (ms_t)-BATTERY_TIME; // millis() of the last sample, the first one is taken at once
+
+static void senseBattery() {
+  uint8_t reading = adcRead(BATTERY_MUX, 2);
+
+  if (reading < batteryReading(LOW_BATTERY))
+    lowBattery = true;
+  else if (reading >= batteryReading(GOOD_BATTERY))
+    lowBattery = false;
+}
+#endif
+
+#if ANIMATIONS
+/***
+ * Puts the current keyframe into segments, false when no animation runs.
+ * A new request restarts from its first frame. Frames advance on millis(),
+ * so a late loop pass shortens the next frame instead of the whole thing
+ * drifting.
+ */
+static bool animation(uint8_t *segments, ms_t now) {
+  uint8_t start;
+  uint8_t time;
+
+  cli();
+  start = animate;
+  animate = NO_ANIMATION;
+  sei();
+  if (start != NO_ANIMATION) {
+    keyframe = start;
+    frameTime = now;
+  }
+  if (keyframe == NO_ANIMATION)
+    return false;
+  while ((time = pgm_read_byte(&FRAMES[keyframe].time)) && ((ms_t)(now - frameTime) >= ((uint16_t)time << FRAME_SHIFT))) {
+    frameTime += (uint16_t)time << FRAME_SHIFT;
+    ++keyframe;
+  }
+  if (! time) {
+    keyframe = NO_ANIMATION;
+    return false;
+  }
+  for (uint8_t i = 0; i < 4; ++i)
+    segments[i] = pgm_read_byte(&FRAMES[keyframe].segments[i]);
+  return true;
+}
+#endif
+
+#if MATCH_MODE
+const uint8_t HISTORY_SHIFT = 10; // History pages last 1.024 sec.
+
+static_assert(timeFits((uint32_t)(MAX_SETS + 2) << HISTORY_SHIFT), "History view outlasts millis()");
+
+ms_t historyTime; // millis() the history view started
+#endif
+
+#if CLOCK_MODE
+// m.ss from a minute up, ss.t below, with lead in front while there is room
+static void showClock(uint8_t *segments, uint8_t lead, const countdown_t &c) {
+  if (c.minutes) {
+    segments[0] = c.minutes >= 10 ? pgm_read_byte(&DIGITS[c.minutes / 10]) : lead;
+    segments[1] = pgm_read_byte(&DIGITS[c.minutes % 10]) | DOT;
+    segments[2] = pgm_read_byte(&DIGITS[c.seconds / 10]);
+    segments[3] = pgm_read_byte(&DIGITS[c.seconds % 10]);
+  } else {
+    segments[0] = lead;
+    segments[1] = pgm_read_byte(&DIGITS[c.seconds / 10]);
+    segments[2] = pgm_read_byte(&DIGITS[c.seconds % 10]) | DOT;
+    segments[3] = pgm_read_byte(&DIGITS[c.tenths]);
+  }
+}
+#endif
+
+#if CALIBRATE
+/***
+ * "+" starts the count together with a reference stopwatch and stops it
+ * when that shows CALIBRATE_SECONDS. Off by more than 1/64 means OSCCAL
+ * takes a step and the run has to be repeated ("OSC"), otherwise the rest
+ * becomes clockTrim ("donE"). Both go to EEPROM.
+ */
+const uint8_t CAL_IDLE = 0;
+const uint8_t CAL_RUNNING = 1;
+const uint8_t CAL_RETUNED = 2;
+const uint8_t CAL_DONE = 3;
+
+uint8_t calibration = CAL_IDLE;
+countdown_t calClock; // Counted so far, counting up
+uint8_t calMs; // Into the current tenth
+ms_t calTime; // millis() counted up to
+
+static void calibrate() {
+  const uint32_t REFERENCE = CALIBRATE_SECONDS * 1000UL;
+
+  uint32_t measured = (((uint32_t)calClock.minutes * 60 + calClock.seconds) * 10 + calClock.tenths) * 100 + calMs;
+  int32_t behind = REFERENCE - measured; // ms the nominal millis() fell behind the reference
+
+  static_assert((REFERENCE >> 6) < 0x8000, "behind << 16 must fit int32_t");
+  if ((behind > (int32_t)(REFERENCE >> 6)) || (behind < -(int32_t)(REFERENCE >> 6))) {
+    OSCCAL = behind > 0 ? OSCCAL + 1 : OSCCAL - 1; // Slow oscillator, speed it up
+    clockTrim = 0;
+    calibration = CAL_RETUNED;
+  } else {
+    clockTrim = (behind << 16) / (int32_t)(measured / PRESS_TICK); // PRESS_TICK up front would overflow
+    calibration = CAL_DONE;
+  }
+  eeprom_update_byte(&EE_OSCCAL, OSCCAL);
+  eeprom_update_word(&EE_TRIM, clockTrim);
+}
+#endif
+
+uint8_t shown[5] = { 0, 0, 0, 0, 0 }; // Segments and control byte on the display
+
+/***
+ * Bus health, readable with a debugger:
+ * errors - bytes the TM1637 did not acknowledge, saturating
+ * retries - frames sent again because of them, saturating
+ * backoff - current wait before the next retry in ms, 0 when the bus is fine
+ * retryAt - low byte of millis() of the next retry
+ */
+struct bus_t {
+  uint8_t errors;
+  uint8_t retries;
+  uint8_t backoff;
+  uint8_t retryAt;
+};
+
+bus_t bus = { 0, 0, 0, 0 };
+ms_t refreshTime; // millis() of the last full frame
+
+static_assert(timeFits(REFRESH_TIME), "Refresh period outlasts millis()");
+
+/***
+ * Sends only what differs from shown[]: the digits from the first to the
+ * last changed one in a single auto-increment write, and the control byte
+ * if it changed. A failed frame is resent whole, since it is unknown which
+ * bytes the TM1637 took, and so is everything once every REFRESH_TIME, as
+ * the chip acknowledges fine after a brown-out that lost its RAM.
+ */
+static void display(const uint8_t *segments, uint8_t control, ms_t now) {
+  const uint8_t ADDR_AUTO = 0x40;
+  const uint8_t STARTADDR = 0xC0;
+
+  uint8_t first = 4; // First and last digit to send, none while first > last
+  uint8_t last = 0;
+  bool sendControl = shown[4] != control;
+  uint8_t acks = 0;
+  uint8_t bytes = 0;
+  bool full = false;
+
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (shown[i] != segments[i]) {
+      shown[i] = segments[i];
+      if (first > i)
+        first = i;
+      last = i;
+    }
+  }
+  if (bus.backoff) { // Last frame failed, resend it once the wait is over
+    if ((int8_t)((uint8_t)now - bus.retryAt) < 0)
+      return;
+    if (bus.retries < 0xFF)
+      ++bus.retries;
+    full = true;
+  } else if ((ms_t)(now - refreshTime) >= REFRESH_TIME) {
+    full = true;
+  } else if ((first > last) && (! sendControl)) {
+    return;
+  }
+  if (full) {
+    first = 0;
+    last = 3;
+    sendControl = true;
+    refreshTime = now;
+  }
+  shown[4] = control;
+  setClock(CLOCK_FULL, CLOCK_IDLE);
+  if (first <= last) {
+    _start();
+    acks = _writeByte(ADDR_AUTO);
+    _stop();
+    _start();
+    acks += _writeByte(STARTADDR + first);
+    for (uint8_t i = first; i <= last; ++i) {
+      acks += _writeByte(segments[i]);
+    }
+    _stop();
+    bytes = last - first + 3;
+  }
+  if (sendControl) {
+    _start();
+    acks += _writeByte(control);
+    _stop();
+    ++bytes;
+  }
+  setClock(CLOCK_IDLE, CLOCK_FULL);
+  if (acks == bytes) {
+    bus.backoff = 0;
+  } else {
+    bus.errors = bytes - acks < 0xFF - bus.errors ? bus.errors + bytes - acks : 0xFF;
+    bus.backoff = bus.backoff ? (bus.backoff < MAX_BACKOFF ? bus.backoff << 1 : MAX_BACKOFF) : 1;
+    bus.retryAt = now + bus.backoff;
+  }
+}
+
+#if INPUT_BACKEND == INPUT_HYBRID
+/***
+ * Nothing is timed while the display is blank, so the chip powers down,
+ * which stops Timer0 and millis() too, until a button goes down. The check
+ * runs with interrupts off after PCIF is cleared, and the sleep instruction
+ * right after sei() still executes, so a press that comes later wakes it at
+ * once. Returns false without sleeping when something is still going on.
+ */
+static bool powerDown() {
+  bool idle;
+
+  cli();
+  GIFR = 1 << PCIF;
+  idle = (getRunstate(state) == RUN_BLANK) && (! readButtons()) && (! (state.pressed[0] | state.pressed[1])) && (! bus.backoff);
+#if ANIMATIONS
+  idle = idle && (keyframe == NO_ANIMATION) && (animate == NO_ANIMATION);
+#endif
+#if BUZZER
+  idle = idle && (! noteLeft);
+#endif
+#if MATCH_MODE
+  idle = idle && (! historyShown);
+#endif
+  if (idle) {
+    GIMSK = 1 << PCIE;
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    GIMSK = 0;
+    set_sleep_mode(SLEEP_MODE_IDLE);
+  }
+  sei();
+  return idle;
 }
+#endif
 
 int main() {
 /***
@@ -154,16 +1667,56 @@ int main() {
 //  pinMode(TM_CLK_PIN, OUTPUT);
 //  pinMode(TM_DIO_PIN, OUTPUT);
   DDRB |= ((1 << TM_CLK_PIN) | (1 << TM_DIO_PIN));
+#if BUZZER
+  DDRB |= 1 << BUZZER_PIN;
+#endif
+#if ! KEYSCAN
   for (uint8_t i = 0; i < 2; ++i) {
 //    pinMode(BTN_PINS[i], INPUT_PULLUP);
     DDRB &= ~(1 << BTN_PINS[i]);
     PORTB |= (1 << BTN_PINS[i]);
   }
+#endif
+#if ENCODER
+  for (uint8_t i = 0; i < 2; ++i) {
+    DDRB &= ~(1 << ENC_PINS[i]);
+    PORTB |= (1 << ENC_PINS[i]);
+  }
+  PCMSK = (1 << ENC_PINS[0]) | (1 << ENC_PINS[1]);
+  GIMSK = 1 << PCIE;
+#endif
+#if INPUT_BACKEND == INPUT_HYBRID
+  PCMSK = (1 << BTN_PINS[0]) | (1 << BTN_PINS[1]);
+#endif
+#if DEBOUNCE_EEPROM
+  for (uint8_t i = 0; i < 2; ++i) {
+    uint8_t window = eeprom_read_byte(&EE_DEBOUNCE[i]);
+
+    if ((window >= MIN_DEBOUNCE_TICKS) && (window <= MAX_DEBOUNCE_TICKS)) // Not erased
+      bounce[i].window = window;
+  }
+#endif
+#if MATCH_MODE
+  if (eeprom_read_byte(&EE_SETS) <= MAX_SETS) { // Not erased
+    sets = eeprom_read_byte(&EE_SETS);
+    history = eeprom_read_word(&EE_HISTORY);
+  }
+#endif
+#if CLOCK_MODE
+  if (eeprom_read_byte(&EE_OSCCAL) != 0xFF) { // Calibrated
+    OSCCAL = eeprom_read_byte(&EE_OSCCAL);
+    clockTrim = eeprom_read_word(&EE_TRIM);
+  }
+#endif
+#if LIGHT_SENSOR || BATTERY_MONITOR
+  DIDR0 = 1 << ADC1D; // No digital input buffer on the analog pin
+#endif
   TCCR0A = 1 << WGM01; // CTC mode
-  TCCR0B = (1 << CS01) | (1 << CS00); // Prescaler /64
-  OCR0A = 149; // 150 - 1
+  TCCR0B = tickCS(CLOCK_FULL);
+  OCR0A = tickCounts(CLOCK_FULL) - 1;
   TIMSK0 = 1 << OCIE0A;
 //  TCNT0 = 0;
+  setClock(CLOCK_IDLE, CLOCK_FULL);
   sei();
   set_sleep_mode(SLEEP_MODE_IDLE);
 
@@ -173,26 +1726,76 @@ int main() {
 
   for (;;) {
     uint8_t segments[4];
-    uint16_t uptime = millis();
+    view_t view;
 
-    if ((runstate != RUN_IDLE) && (uptime - stateTime >= STATE_DURATION)) {
-      runstate = RUN_IDLE;
-      brightness = DIM_BRIGHT;
+#if KEYSCAN
+    if ((uint8_t)(_ms - scanTime) >= KEYSCAN_TIME) {
+      scanTime = _ms;
+      keys = scanKeys();
     }
-
+#endif
+    snapshot(view);
+#if LIGHT_SENSOR
+    if ((getRunstate(view) != RUN_BLANK) && ((ms_t)(view.uptime - lightTime) >= LIGHT_TIME)) {
+      lightTime = view.uptime;
+      senseLight();
+    }
+#endif
+#if BATTERY_MONITOR
+    if ((ms_t)(view.uptime - batteryTime) >= BATTERY_TIME) {
+      batteryTime = view.uptime;
+      senseBattery();
+    }
+#endif
+#if CALIBRATE
+    if (calibrateMark) {
+      calibrateMark = false;
+      if (calibration == CAL_RUNNING) {
+        calibrate();
+      } else {
+        calClock.minutes = calClock.seconds = calClock.tenths = 0;
+        calMs = 0;
+        calTime = view.uptime;
+        calibration = CAL_RUNNING;
+      }
+    }
+    if (calibration == CAL_RUNNING) {
+      calMs += (uint8_t)(view.uptime - calTime); // The loop never sleeps through 256 ms
+      calTime = view.uptime;
+      for (; calMs >= 100; calMs -= 100) {
+        if (++calClock.tenths == 10) {
+          calClock.tenths = 0;
+          if (++calClock.seconds == 60) {
+            calClock.seconds = 0;
+            ++calClock.minutes;
+          }
+        }
+      }
+    }
+    if (calibration == CAL_RETUNED) {
+      segments[0] = glyph('O');
+      segments[1] = glyph('S');
+      segments[2] = glyph('C');
+      segments[3] = 0;
+    } else if (calibration == CAL_DONE) {
+      segments[0] = glyph('d');
+      segments[1] = glyph('o');
+      segments[2] = glyph('n');
+      segments[3] = glyph('E');
+    } else {
+      showClock(segments, glyph('C'), calClock);
+    }
+#elif CLOCK_MODE
+    showClock(segments, view.turn ? glyph('r') : glyph('L'), view.countdown);
+#else
     for (uint8_t i = 0; i < 2; ++i) {
-      static const uint8_t DIGITS[10] = {
-        0B00111111, 0B00000110, 0B01011011, 0B01001111, 0B01100110, 0B01101101, 0B01111101, 0B0000111, 0B01111111, 0B01101111
-      };
-      const uint8_t MINUS = 0B01000000;
-      const uint8_t DOT = 0B10000000;
-
-      bool draw = (runstate != RUN_LEFT + i) || (uptime % 500 < 250);
+      uint8_t score = getScore(view, i);
+      bool draw = (getRunstate(view) != RUN_LEFT + i) || ((ms_t)(view.uptime - view.stateTime) % 500 < 250); // Blink restarts on input
 
       if (draw) {
-        if (score[i]) {
-          segments[i * 2] = DIGITS[score[i] / 10];
-          segments[i * 2 + 1] = DIGITS[score[i] % 10] | DOT;
+        if (score || MATCH_MODE) { // 0 is a normal score in a match
+          segments[i * 2] = pgm_read_byte(&DIGITS[score / 10]);
+          segments[i * 2 + 1] = pgm_read_byte(&DIGITS[score % 10]) | DOT;
         } else {
           segments[i * 2] = MINUS;
           segments[i * 2 + 1] = MINUS | DOT;
@@ -202,8 +1805,81 @@ int main() {
         segments[i * 2 + 1] = DOT;
       }
     }
-    display(segments);
+#if MATCH_MODE
+    if (matchWon(view.history, view.sets)) { // Sets won by each until a new match
+      for (uint8_t i = 0; i < 2; ++i) {
+        segments[i * 2] = 0;
+        segments[i * 2 + 1] = pgm_read_byte(&DIGITS[setsWon(view.history, view.sets, i)]) | DOT;
+      }
+    }
+#endif
+#endif
+#if BATTERY_MONITOR
+    if (lowBattery && (getRunstate(view) != RUN_BLANK) && (view.uptime & 0x0200)) { // Dots off half of every 1.024 sec.
+      segments[1] &= ~DOT;
+      segments[3] &= ~DOT;
+    }
+#endif
+#if MATCH_MODE
+    if (historyAsked) {
+      historyAsked = false;
+      historyTime = view.uptime;
+      historyShown = true;
+    }
+    if (historyShown) { // Sets won, then one page per set: number and winner
+      uint8_t page = (ms_t)(view.uptime - historyTime) >> HISTORY_SHIFT;
+
+      if (page > view.sets) {
+        historyShown = false;
+      } else if (! page) {
+        for (uint8_t i = 0; i < 2; ++i) {
+          segments[i * 2] = 0;
+          segments[i * 2 + 1] = pgm_read_byte(&DIGITS[setsWon(view.history, view.sets, i)]) | DOT;
+        }
+      } else {
+        segments[0] = page < 10 ? 0 : pgm_read_byte(&DIGITS[1]);
+        segments[1] = pgm_read_byte(&DIGITS[page < 10 ? page : page - 10]);
+        segments[2] = MINUS;
+        segments[3] = view.history & ((uint16_t)1 << (page - 1)) ? glyph('r') : glyph('L');
+      }
+    }
+#endif
+#if ANIMATIONS
+    animation(segments, view.uptime);
+#endif
+#if STACK_PAINT
+    if (stackShown) {
+      uint8_t bytes = stackFree();
+
+      segments[0] = MINUS;
+      segments[1] = 0;
+      segments[2] = pgm_read_byte(&DIGITS[bytes / 10]);
+      segments[3] = pgm_read_byte(&DIGITS[bytes % 10]);
+    }
+#endif
+    display(segments, getRunstate(view) == RUN_BLANK ? DISPLAY_OFF : DISPLAY_ON | ambient(getBrightness(view)), view.uptime);
+#if MATCH_MODE
+    if (getRunstate(view) == RUN_IDLE) {
+      eeprom_update_byte(&EE_SETS, view.sets);
+      eeprom_update_word(&EE_HISTORY, view.history);
+    }
+#endif
+#if DEBOUNCE_EEPROM
+    if (getRunstate(view) == RUN_BLANK) { // Nobody is pressing, and the window drifts by a tick a press
+      for (uint8_t i = 0; i < 2; ++i) {
+        uint8_t window = bounce[i].window;
+        uint8_t saved = eeprom_read_byte(&EE_DEBOUNCE[i]);
+
+        if ((window > saved + DEBOUNCE_DRIFT) || (saved > window + DEBOUNCE_DRIFT))
+          eeprom_update_byte(&EE_DEBOUNCE[i], window);
+      }
+    }
+#endif
 
+#if INPUT_BACKEND == INPUT_HYBRID
+    if (powerDown()) // Woke up on a button
+      continue;
+#endif
     sleep_mode();
   }
 }
@@ -0,0 +1,173 @@
+/***
+ * Scripted gesture checks for stage 4.
+ *
+ * Runs the firmware on the host ATtiny13 model (host/avrsim.h) through a
+ * fixed sequence of clicks and chords and compares both scores with the
+ * expected ones after every step, so a sequence that went wrong once stays
+ * checked. With -D UNDO=1 it also takes back changes across two resets in a
+ * row, of which only the latest keeps its scores. With -D ENCODER=1 "+" is a
+ * detent and the chord is a detent up with "-" held.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -std=gnu++11 -Itools/host [-DUNDO=1] [-DENCODER=1] -o gestures tools/gestures.cpp
+ *   ./gestures
+ */
+
+#define AVRSIM_IMPLEMENTATION
+#include "avrsim.h"
+
+#define main firmwareMain
+#include "../4/src/main.cpp"
+#if KEYSCAN || CLOCK_MODE || MATCH_MODE || CALIBRATE
+#error "The script presses PB0..PB2 and expects plain scores"
+#endif
+#undef main
+
+#include <stdio.h>
+#include <vector>
+
+using avrsim::chip;
+
+const uint64_t MS = F_CPU / 1000;
+
+struct check_t {
+  uint64_t time;
+  const char *name;
+  uint8_t scores[2];
+};
+
+static std::vector<check_t> checks;
+static size_t next = 0; // Check waiting for its time
+static unsigned failed = 0;
+
+static void onIsr(avrsim::vector_t) {
+  for (; (next < checks.size()) && (checks[next].time <= chip.now); ++next) {
+    const check_t &c = checks[next];
+    uint8_t left = getScore(state, 0), right = getScore(state, 1);
+    bool ok = (left == c.scores[0]) && (right == c.scores[1]);
+
+    printf("%-32s %2u:%-2u %s", c.name, left, right, ok ? "ok\n" : "");
+    if (! ok) {
+      printf("expected %u:%u\n", c.scores[0], c.scores[1]);
+      ++failed;
+    }
+  }
+}
+
+struct script_t {
+  uint64_t t;
+
+  // Press and release of button i, then a pause longer than DOUBLE_TIME
+  void press(uint8_t i, uint32_t ms = 100) {
+    chip.input(t, BTN_PINS[i], false);
+    t += ms * MS;
+    chip.input(t, BTN_PINS[i], true);
+    t += 500 * MS;
+  }
+
+  // "-" then "+" within CHORD_TIME, a tap or held past HOLD_TIME
+  void chord(uint32_t ms) {
+    chip.input(t, BTN_PINS[0], false);
+    t += 50 * MS;
+    press(1, ms);
+    chip.input(t - 500 * MS, BTN_PINS[0], true);
+  }
+
+  void tap() {
+    chord(150);
+  }
+
+  void reset() {
+    chord(HOLD_TIME + 300);
+  }
+
+#if ENCODER
+  // One detent clockwise: A falls, B falls, A rises, B rises
+  void turn() {
+    for (uint8_t k = 0; k < 4; ++k) {
+      chip.input(t, ENC_PINS[k & 0x01], k >= 2);
+      t += 2 * MS;
+    }
+    t += 500 * MS;
+  }
+
+  // A detent up with "-" held
+  void turnHeld() {
+    chip.input(t, BTN_PINS[0], false);
+    t += 150 * MS;
+    turn();
+    chip.input(t - 400 * MS, BTN_PINS[0], true);
+  }
+#endif
+
+  // Until the selected side times out
+  void idle() {
+    t += STATE_DURATION * MS;
+  }
+
+  void expect(const char *name, uint8_t left, uint8_t right) {
+    checks.push_back({ t, name, { left, right } });
+  }
+};
+
+int main() {
+  const uint8_t S = START_SCORE;
+
+  script_t script = { 200 * MS };
+
+#if ENCODER
+  script.press(0); // Selects the left side
+  script.turn();
+  script.expect("a detent up on the left", S + 1, S);
+  script.press(0);
+  script.expect("a stray \"-\" on the left", S, S);
+  script.turnHeld();
+#if UNDO
+  script.expect("undo by a detent with \"-\" held", S + 1, S);
+#else
+  script.expect("reset by a detent with \"-\" held", S, S);
+#endif
+#else
+  script.press(0); // Selects the left side
+  script.press(0);
+  script.press(0);
+  script.press(0);
+  script.expect("three \"-\" on the left", S - 3, S);
+  script.reset();
+  script.expect("reset", S, S);
+  script.press(0);
+  script.press(1);
+  script.expect("\"+\" on the left", S + 1, S);
+#if UNDO
+  script.reset();
+  script.expect("second reset", S, S);
+  script.tap();
+  script.expect("undo the second reset", S + 1, S);
+  script.tap();
+  script.expect("undo the \"+\"", S, S);
+  script.tap();
+  script.expect("nothing left before the reset", S, S);
+  script.idle();
+  script.press(1); // Selects the right side
+  script.press(1);
+  script.tap();
+  script.expect("undo a \"+\" on the right", S, S);
+#else
+  script.tap();
+  script.expect("reset by a chord", S, S);
+#endif
+#endif
+
+  chip.onIsr = onIsr;
+  chip.stopAt = script.t + 100 * MS;
+  try {
+    firmwareMain();
+  } catch (const avrsim::Stop &) {
+  }
+  if (next < checks.size()) {
+    fprintf(stderr, "Stopped before the last check\n");
+    return 1;
+  }
+  printf("%u of %zu checks failed\n", failed, checks.size());
+  return failed ? 1 : 0;
+}
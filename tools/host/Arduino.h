@@ -0,0 +1,80 @@
+#pragma once
+
+/***
+ * Just enough of the Arduino core for the sketches of stages 0 and 1 (and the
+ * TM1637 library of stage 0) to run on the host model. main() calls setup()
+ * and loop() the usual way, and millis() counts Timer0 overflows at /64 as
+ * most cores do, so the chip also wakes up on every overflow.
+ */
+
+#include "avrsim.h"
+
+#define LOW 0
+#define HIGH 1
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+const uint32_t CORE_PIN_CYCLES = 20; // Pin number to port and mask lookup of the core, roughly
+const uint32_t CORE_TICK_CYCLES = 64UL * 256; // Oscillator cycles per Timer0 overflow
+
+static volatile uint32_t _coreTicks = 0;
+
+ISR(TIM0_COMPA_vect) { // The model flags compare A on the overflow in normal mode
+  ++_coreTicks;
+}
+
+static inline uint32_t millis() {
+  return (uint64_t)_coreTicks * CORE_TICK_CYCLES * 1000 / F_CPU;
+}
+
+static inline void delay(uint32_t ms) {
+  _delay_ms(ms);
+}
+
+static inline void delayMicroseconds(uint16_t us) {
+  _delay_us(us);
+}
+
+static inline void pinMode(uint8_t pin, uint8_t mode) {
+  avrsim::chip.charge(CORE_PIN_CYCLES);
+  if (mode == OUTPUT) {
+    DDRB |= 1 << pin;
+  } else {
+    DDRB &= ~(1 << pin);
+    if (mode == INPUT_PULLUP)
+      PORTB |= 1 << pin;
+    else
+      PORTB &= ~(1 << pin);
+  }
+}
+
+static inline void digitalWrite(uint8_t pin, uint8_t value) {
+  avrsim::chip.charge(CORE_PIN_CYCLES);
+  if (value)
+    PORTB |= 1 << pin;
+  else
+    PORTB &= ~(1 << pin);
+}
+
+static inline int digitalRead(uint8_t pin) {
+  avrsim::chip.charge(CORE_PIN_CYCLES);
+  return (PINB >> pin) & 0x01;
+}
+
+void setup();
+void loop();
+
+static void init() {
+  TCCR0B = (1 << CS01) | (1 << CS00); // Prescaler /64, normal mode
+  TIMSK0 = 1 << OCIE0A;
+  sei();
+}
+
+int main() {
+  init();
+  setup();
+  for (;;)
+    loop();
+}
@@ -0,0 +1,683 @@
+#pragma once
+
+/***
+ * Host-side ATtiny13 stand-in.
+ *
+ * Lets a firmware stage be compiled with the host g++ and run against a
+ * cycle-approximate model of the parts of the chip it touches: PORTB/DDRB/PINB,
+ * Timer0 in CTC mode with OC0A toggling, the pin change interrupt, the ADC, sleep modes and a
+ * TM1637 on the bus. Time is kept in oscillator cycles (F_CPU), so system clock
+ * prescaling stays exact. Only register accesses, delays and interrupt entry
+ * are charged; plain arithmetic is free, which is close enough as long as the
+ * firmware spends its time in _delay_us() and sleep.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#ifndef F_CPU
+#define F_CPU 9600000UL
+#endif
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define OCIE0A 2
+#define OCIE0B 3
+#define TOIE0 1
+#define PCIE 5
+#define PCIF 5
+#define INT0 6
+#define SE 5
+#define SM0 3
+#define SM1 4
+#define CLKPCE 7
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define MUX0 0
+#define MUX1 1
+#define ADLAR 5
+#define REFS0 6
+#define AIN0D 0
+#define AIN1D 1
+#define ADC1D 2
+#define ADC3D 3
+#define ADC2D 4
+#define ADC0D 5
+
+#define _BV(bit) (1 << (bit))
+
+namespace avrsim {
+
+enum reg_t : uint8_t { R_PORTB, R_DDRB, R_PINB, R_PCMSK, R_GIMSK, R_GIFR, R_TCCR0A, R_TCCR0B, R_OCR0A, R_OCR0B, R_TCNT0, R_TIMSK0, R_TIFR0, R_MCUCR, R_CLKPR, R_SREG, R_ADMUX, R_ADCSRA, R_ADCSRB, R_ADCL, R_ADCH, R_DIDR0, R_OSCCAL, R_COUNT };
+enum sleep_t : uint8_t { SLEEP_IDLE, SLEEP_ADC, SLEEP_PWR_DOWN, SLEEP_NONE };
+enum vector_t : uint8_t { V_PCINT0, V_TIM0_COMPA, V_ADC, V_COUNT };
+
+struct Stop { }; // Thrown out of the firmware when the simulation is over
+
+class Reg8 {
+public:
+  explicit Reg8(reg_t id) : _id(id) { }
+
+  operator uint8_t() const;
+  Reg8 &operator=(uint8_t value);
+  Reg8 &operator|=(uint8_t value);
+  Reg8 &operator&=(uint8_t value);
+  Reg8 &operator^=(uint8_t value);
+
+private:
+  reg_t _id;
+};
+
+/***
+ * TM1637 bus decoder. Watches CLK/DIO, acknowledges every byte and keeps the
+ * display RAM and control byte the way the chip would.
+ */
+struct TM1637Model {
+  uint8_t segments[6];
+  uint8_t control; // Last display control command (0x80..0x8F)
+  uint64_t lastDataTime; // When the last data byte of a write was latched
+  uint64_t frameStartTime; // Start condition of the transaction carrying it
+  uint32_t frames; // Completed data writes
+  uint32_t bytes;
+
+  uint16_t nackRate; // Chance out of 65536 to miss an ACK, for loose connector tests
+  uint32_t nacks;
+
+  uint8_t key; // Scan code returned by the read key command (0xFF - no key)
+  uint8_t reading; // Key code bits shifted out so far, 0 - not reading
+
+  bool clk, dio;
+  bool pullLow; // Chip drives DIO low (ACK)
+  bool inFrame;
+  uint8_t bit, data, index, address, command, lastCommand;
+  uint64_t startTime;
+
+  uint32_t seed;
+
+  void reset() {
+    memset(this, 0, sizeof(*this));
+    clk = dio = true;
+    seed = 1;
+    key = 0xFF;
+  }
+  void update(bool newClk, bool newDio, uint64_t now);
+  void byteDone(uint64_t now);
+};
+
+struct Chip {
+  uint8_t regs[R_COUNT];
+  uint8_t extPins; // Levels driven into input pins from outside
+  uint8_t sleepMode;
+  bool inIsr;
+
+  uint64_t now; // Oscillator cycles
+  uint64_t stopAt;
+  uint64_t sleepTime[SLEEP_NONE]; // Time spent in each sleep mode
+  uint64_t clockCycles[SLEEP_NONE + 1]; // System clock cycles in each sleep mode, SLEEP_NONE - awake, none in power-down
+  uint64_t isrCount[V_COUNT];
+  uint32_t eepromWrites;
+
+  double vcc; // Supply, the ADC reference unless REFS0 selects the 1.1 V bandgap
+  double analog[4]; // Volts on ADC0..ADC3
+  uint64_t adcLeft; // Oscillator cycles to the end of the running conversion, 0 - none
+  bool adcFirst; // Next conversion is the 25 cycle one after enabling
+  uint64_t adcTime; // Time spent with the ADC enabled
+  uint32_t conversions;
+
+  uint32_t ioResidual; // Oscillator cycles short of the next clk_I/O cycle
+  uint16_t prescaler; // Timer0 prescaler, a free running 10-bit clk_I/O counter shared by all CS settings
+  bool oc0a; // Output compare A flip-flop, drives PB0 while COM0A is set
+  uint32_t oc0aToggles;
+  uint8_t lastPins;
+
+  struct Event {
+    uint64_t time;
+    uint8_t pin;
+    bool level;
+  };
+  std::vector<Event> events; // Scheduled input changes, sorted by time
+
+  TM1637Model tm;
+  uint8_t tmClkPin, tmDioPin;
+
+  void (*onIsr)(vector_t vector); // Called after every interrupt handler returns
+  void (*onBus)(); // Called whenever the TM1637 latches a byte
+
+  Chip() { // Arduino sketches touch the pins from static constructors
+    reset();
+  }
+
+  void reset(uint8_t clkPin = PB3, uint8_t dioPin = PB4) {
+    memset(regs, 0, sizeof(regs));
+    regs[R_OSCCAL] = 0x5A; // Some factory value
+    extPins = 0xFF;
+    sleepMode = SLEEP_NONE;
+    inIsr = false;
+    now = 0;
+    stopAt = UINT64_MAX;
+    memset(sleepTime, 0, sizeof(sleepTime));
+    memset(clockCycles, 0, sizeof(clockCycles));
+    memset(isrCount, 0, sizeof(isrCount));
+    eepromWrites = 0;
+    vcc = 5.0;
+    for (uint8_t i = 0; i < 4; ++i)
+      analog[i] = 0;
+    adcLeft = 0;
+    adcFirst = true;
+    adcTime = 0;
+    conversions = 0;
+    ioResidual = 0;
+    prescaler = 0;
+    oc0a = false;
+    oc0aToggles = 0;
+    events.clear();
+    tm.reset();
+    tmClkPin = clkPin;
+    tmDioPin = dioPin;
+    lastPins = pins();
+    onIsr = NULL;
+    onBus = NULL;
+  }
+
+  uint8_t clockDiv() const {
+    return 1 << (regs[R_CLKPR] & 0x0F);
+  }
+  uint32_t timerDiv() const {
+    static const uint16_t DIVS[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+    return DIVS[regs[R_TCCR0B] & 0x07];
+  }
+  uint8_t pins() const {
+    uint8_t ddr = regs[R_DDRB];
+    uint8_t level = (regs[R_PORTB] & ddr) | (extPins & ~ddr);
+
+    if ((regs[R_TCCR0A] & ((1 << COM0A1) | (1 << COM0A0))) && (ddr & (1 << PB0)))
+      level = (level & ~(1 << PB0)) | (oc0a ? 1 << PB0 : 0);
+
+    if (tm.pullLow)
+      level &= ~(1 << tmDioPin);
+    return level & 0x3F;
+  }
+
+  // Schedules an external level change on an input pin
+  void input(uint64_t time, uint8_t pin, bool level) {
+    Event e = { time, pin, level };
+
+    events.insert(std::upper_bound(events.begin(), events.end(), e, [](const Event &a, const Event &b) { return a.time < b.time; }), e);
+  }
+
+  void charge(uint32_t cpuCycles) {
+    advance((uint64_t)cpuCycles * clockDiv());
+    dispatch();
+  }
+
+  void pinsChanged() {
+    uint8_t level = pins();
+    uint8_t changed = level ^ lastPins;
+
+    lastPins = level;
+    if (changed & regs[R_PCMSK])
+      regs[R_GIFR] |= 1 << PCIE;
+    if (changed & ((1 << tmClkPin) | (1 << tmDioPin))) {
+      uint32_t frames = tm.frames, bytes = tm.bytes;
+
+      tm.update((level >> tmClkPin) & 0x01, (level >> tmDioPin) & 0x01, now);
+      if (pins() != level) // ACK toggled DIO
+        pinsChanged();
+      if (onBus && ((tm.bytes != bytes) || (tm.frames != frames)))
+        onBus();
+    }
+  }
+
+  // Moves the clock forward, stepping Timer0 and applying input events
+  void advance(uint64_t cycles) {
+    uint64_t target = now + cycles;
+
+    while (now < target) {
+      uint64_t step = target - now;
+
+      if ((! events.empty()) && (events.front().time - now < step))
+        step = events.front().time > now ? events.front().time - now : 0;
+      if (adcLeft && (adcLeft < step))
+        step = adcLeft;
+      timerRun(step);
+      adcRun(step);
+      if (sleepMode != SLEEP_PWR_DOWN) // The oscillator stops
+        clockCycles[sleepMode] += step / clockDiv();
+      now += step;
+      while ((! events.empty()) && (events.front().time <= now)) {
+        if (events.front().level)
+          extPins |= 1 << events.front().pin;
+        else
+          extPins &= ~(1 << events.front().pin);
+        events.erase(events.begin());
+        pinsChanged();
+      }
+    }
+    if (now >= stopAt)
+      throw Stop();
+  }
+
+  void timerRun(uint64_t cycles) {
+    if ((sleepMode == SLEEP_PWR_DOWN) || (sleepMode == SLEEP_ADC)) // clk_I/O is halted
+      return;
+    cycles += ioResidual;
+
+    uint64_t io = cycles / clockDiv();
+    uint32_t div = timerDiv();
+    uint64_t counts = div ? (prescaler % div + io) / div : 0;
+
+    ioResidual = cycles % clockDiv();
+    prescaler = (prescaler + io) & 0x3FF;
+    while (counts) {
+      uint16_t top = (regs[R_TCCR0A] & (1 << WGM01)) ? regs[R_OCR0A] : 0xFF;
+      uint16_t left = top - regs[R_TCNT0] + 1; // Counts to the next compare
+
+      if (counts < left) {
+        regs[R_TCNT0] += counts;
+        counts = 0;
+      } else {
+        regs[R_TCNT0] = 0;
+        regs[R_TIFR0] |= 1 << OCIE0A;
+        if ((regs[R_TCCR0A] & ((1 << COM0A1) | (1 << COM0A0))) == (1 << COM0A0)) { // Toggle mode, the only one modelled
+          oc0a = ! oc0a;
+          ++oc0aToggles;
+        }
+        counts -= left;
+      }
+    }
+  }
+
+  // ADC clock is the system clock through ADPS, 13 cycles per conversion (25 for the first)
+  void adcStart() {
+    static const uint8_t DIVS[8] = { 2, 2, 4, 8, 16, 32, 64, 128 };
+
+    if ((! (regs[R_ADCSRA] & (1 << ADEN))) || adcLeft)
+      return;
+    regs[R_ADCSRA] |= 1 << ADSC;
+    adcLeft = (uint64_t)(adcFirst ? 25 : 13) * DIVS[regs[R_ADCSRA] & 0x07] * clockDiv();
+    adcFirst = false;
+  }
+
+  void adcRun(uint64_t cycles) {
+    if (regs[R_ADCSRA] & (1 << ADEN))
+      adcTime += cycles;
+    if (! adcLeft)
+      return;
+    adcLeft -= std::min(adcLeft, cycles);
+    if (! adcLeft) {
+      double ref = regs[R_ADMUX] & (1 << REFS0) ? 1.1 : vcc;
+      double v = analog[regs[R_ADMUX] & 0x03] / ref * 1024;
+      uint16_t result = v < 0 ? 0 : (v > 1023 ? 1023 : (uint16_t)v);
+
+      if (regs[R_ADMUX] & (1 << ADLAR))
+        result <<= 6;
+      regs[R_ADCL] = result;
+      regs[R_ADCH] = result >> 8;
+      regs[R_ADCSRA] = (regs[R_ADCSRA] & ~(1 << ADSC)) | (1 << ADIF);
+      ++conversions;
+    }
+  }
+
+  // Oscillator cycles until the next Timer0 compare match
+  uint64_t timerNext() const {
+    uint32_t div = timerDiv();
+
+    if (! div)
+      return UINT64_MAX;
+
+    uint16_t top = (regs[R_TCCR0A] & (1 << WGM01)) ? regs[R_OCR0A] : 0xFF;
+    uint64_t io = (uint64_t)(top - regs[R_TCNT0] + 1) * div - prescaler % div;
+
+    return io * clockDiv() - ioResidual;
+  }
+
+  bool pending(vector_t vector) const {
+    switch (vector) {
+      case V_PCINT0:
+        return (regs[R_GIFR] & regs[R_GIMSK]) & (1 << PCIE);
+      case V_TIM0_COMPA:
+        return (regs[R_TIFR0] & regs[R_TIMSK0]) & (1 << OCIE0A);
+      case V_ADC:
+        return (regs[R_ADCSRA] & (regs[R_ADCSRA] << 1)) & (1 << ADIF);
+      default:
+        return false;
+    }
+  }
+
+  void dispatch();
+  void sleep();
+};
+
+extern Chip chip;
+
+} // namespace avrsim
+
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void TIM0_COMPA_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+
+#define PORTB (avrsim::Reg8(avrsim::R_PORTB))
+#define DDRB (avrsim::Reg8(avrsim::R_DDRB))
+#define PINB (avrsim::Reg8(avrsim::R_PINB))
+#define PCMSK (avrsim::Reg8(avrsim::R_PCMSK))
+#define GIMSK (avrsim::Reg8(avrsim::R_GIMSK))
+#define GIFR (avrsim::Reg8(avrsim::R_GIFR))
+#define TCCR0A (avrsim::Reg8(avrsim::R_TCCR0A))
+#define TCCR0B (avrsim::Reg8(avrsim::R_TCCR0B))
+#define OCR0A (avrsim::Reg8(avrsim::R_OCR0A))
+#define OCR0B (avrsim::Reg8(avrsim::R_OCR0B))
+#define TCNT0 (avrsim::Reg8(avrsim::R_TCNT0))
+#define TIMSK0 (avrsim::Reg8(avrsim::R_TIMSK0))
+#define TIFR0 (avrsim::Reg8(avrsim::R_TIFR0))
+#define MCUCR (avrsim::Reg8(avrsim::R_MCUCR))
+#define CLKPR (avrsim::Reg8(avrsim::R_CLKPR))
+#define SREG (avrsim::Reg8(avrsim::R_SREG))
+#define ADMUX (avrsim::Reg8(avrsim::R_ADMUX))
+#define ADCSRA (avrsim::Reg8(avrsim::R_ADCSRA))
+#define ADCSRB (avrsim::Reg8(avrsim::R_ADCSRB))
+#define ADCL (avrsim::Reg8(avrsim::R_ADCL))
+#define ADCH (avrsim::Reg8(avrsim::R_ADCH))
+#define DIDR0 (avrsim::Reg8(avrsim::R_DIDR0))
+#define OSCCAL (avrsim::Reg8(avrsim::R_OSCCAL)) // Kept, the oscillator stays at F_CPU whatever it holds
+
+#define ISR(vector, ...) extern "C" void vector(void)
+#define ISR_NOBLOCK
+#define EMPTY_INTERRUPT(vector) extern "C" void vector(void) { }
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+
+// EEMEM variables live in host memory and start zeroed, not erased (0xFF)
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *addr) {
+  avrsim::chip.charge(4);
+  return *addr;
+}
+
+static inline uint16_t eeprom_read_word(const uint16_t *addr) {
+  avrsim::chip.charge(8);
+  return *addr;
+}
+
+// Writes are counted for wear estimates, their 3.4 ms busy time is not modelled
+static inline void eeprom_update_byte(uint8_t *addr, uint8_t value) {
+  avrsim::chip.charge(4);
+  if (*addr != value) {
+    *addr = value;
+    ++avrsim::chip.eepromWrites;
+  }
+}
+
+static inline void eeprom_update_word(uint16_t *addr, uint16_t value) {
+  eeprom_update_byte((uint8_t *)addr, value);
+  eeprom_update_byte((uint8_t *)addr + 1, value >> 8);
+}
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC (1 << SM0)
+#define SLEEP_MODE_PWR_DOWN (1 << SM1)
+
+// The instruction after sei() runs before any pending interrupt, so "sei(); sleep_cpu();" cannot miss a wake-up
+static inline void sei() {
+  avrsim::chip.regs[avrsim::R_SREG] |= 0x80;
+  avrsim::chip.advance(avrsim::chip.clockDiv());
+}
+
+static inline void cli() {
+  avrsim::chip.regs[avrsim::R_SREG] &= ~0x80;
+  avrsim::chip.charge(1);
+}
+
+static inline void set_sleep_mode(uint8_t mode) {
+  avrsim::chip.regs[avrsim::R_MCUCR] = (avrsim::chip.regs[avrsim::R_MCUCR] & ~((1 << SM0) | (1 << SM1))) | mode;
+}
+
+static inline void sleep_enable() {
+  avrsim::chip.regs[avrsim::R_MCUCR] |= 1 << SE;
+}
+
+static inline void sleep_disable() {
+  avrsim::chip.regs[avrsim::R_MCUCR] &= ~(1 << SE);
+}
+
+static inline void sleep_cpu() {
+  if (avrsim::chip.regs[avrsim::R_MCUCR] & (1 << SE))
+    avrsim::chip.sleep();
+}
+
+static inline void sleep_mode() {
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+}
+
+static inline void _delay_us(double us) {
+  avrsim::chip.charge((uint32_t)(us * (F_CPU / 1000000.0) + 0.5));
+}
+
+static inline void _delay_ms(double ms) {
+  _delay_us(ms * 1000.0);
+}
+
+#ifdef AVRSIM_IMPLEMENTATION
+
+namespace avrsim {
+
+Chip chip;
+
+Reg8::operator uint8_t() const {
+  uint8_t value = _id == R_PINB ? chip.pins() : chip.regs[_id];
+
+  chip.charge(1);
+  return value;
+}
+
+Reg8 &Reg8::operator=(uint8_t value) {
+  switch (_id) {
+    case R_PINB: // Writing PINB toggles PORTB
+      chip.regs[R_PORTB] ^= value;
+      break;
+    case R_GIFR:
+    case R_TIFR0: // Flags are cleared by writing ones
+      chip.regs[_id] &= ~value;
+      break;
+    case R_ADCSRA: // ADIF is cleared by writing one, ADSC starts a conversion
+      chip.regs[_id] = (value & ~((1 << ADIF) | (1 << ADSC))) | (chip.regs[_id] & (1 << ADSC)) | (chip.regs[_id] & ~value & (1 << ADIF));
+      if (! (value & (1 << ADEN))) {
+        chip.regs[_id] &= ~(1 << ADSC);
+        chip.adcLeft = 0;
+        chip.adcFirst = true;
+      } else if (value & (1 << ADSC)) {
+        chip.adcStart();
+      }
+      break;
+    case R_CLKPR:
+      if (value & (1 << CLKPCE))
+        chip.regs[_id] = (chip.regs[_id] & 0x0F) | (1 << CLKPCE);
+      else if (chip.regs[_id] & (1 << CLKPCE))
+        chip.regs[_id] = value & 0x0F;
+      break;
+    default:
+      chip.regs[_id] = value;
+  }
+  if ((_id == R_PORTB) || (_id == R_DDRB) || (_id == R_PINB))
+    chip.pinsChanged();
+  chip.charge(1);
+  return *this;
+}
+
+Reg8 &Reg8::operator|=(uint8_t value) {
+  uint8_t old = _id == R_PINB ? chip.regs[R_PORTB] : chip.regs[_id];
+
+  return *this = (_id == R_PINB ? 0 : old) | value;
+}
+
+Reg8 &Reg8::operator&=(uint8_t value) {
+  return *this = chip.regs[_id] & value;
+}
+
+Reg8 &Reg8::operator^=(uint8_t value) {
+  return *this = chip.regs[_id] ^ value;
+}
+
+void TM1637Model::update(bool newClk, bool newDio, uint64_t now) {
+  if (clk && newClk && (dio != newDio)) { // DIO moved while CLK is high
+    if (! newDio) { // Start
+      inFrame = true;
+      bit = data = index = 0;
+      startTime = now;
+    } else { // Stop
+      if (inFrame && (command & 0xC0) == 0xC0 && index > 0) {
+        ++frames;
+      }
+      inFrame = false;
+      command = 0;
+      reading = 0;
+    }
+  } else if (inFrame && (! clk) && newClk) { // Rising edge, sample DIO
+    if (reading) // The MCU samples the key code
+      ;
+    else if (bit < 8) {
+      data |= (newDio ? 1 : 0) << bit;
+      if (++bit == 8)
+        byteDone(now);
+    }
+  } else if (inFrame && clk && (! newClk)) { // Falling edge
+    if (reading) { // Next key code bit, then let the MCU acknowledge
+      pullLow = (reading < 9) && (! ((key >> (reading - 1)) & 0x01));
+      if (++reading > 9)
+        reading = 0;
+    } else if ((bit == 9) && (command == 0x42) && (index == 1)) { // Read key command acknowledged
+      pullLow = ! (key & 0x01);
+      reading = 2;
+      bit = 0;
+      data = 0;
+    } else if (bit == 8) { // Acknowledge on the ninth clock
+      seed = seed * 1103515245 + 12345;
+      pullLow = ((seed >> 16) & 0xFFFF) >= nackRate;
+      if (! pullLow)
+        ++nacks;
+      bit = 9;
+    } else if (bit == 9) {
+      pullLow = false;
+      bit = 0;
+      data = 0;
+    }
+  }
+  clk = newClk;
+  dio = newDio;
+}
+
+void TM1637Model::byteDone(uint64_t now) {
+  ++bytes;
+  if (index == 0) {
+    command = data;
+    if ((data & 0xC0) == 0xC0)
+      address = data & 0x07;
+    else if ((data & 0xC0) == 0x80)
+      control = data;
+  } else if ((command & 0xC0) == 0xC0) {
+    if (address < 6)
+      segments[address] = data;
+    if (! (lastCommand & 0x04)) // Auto increment
+      ++address;
+    lastDataTime = now;
+    frameStartTime = startTime;
+  }
+  if ((index == 0) && ((data & 0xC0) == 0x40))
+    lastCommand = data;
+  ++index;
+}
+
+void Chip::dispatch() {
+  while ((regs[R_SREG] & 0x80) && (! inIsr)) {
+    vector_t vector;
+
+    if (pending(V_PCINT0) && PCINT0_vect) {
+      vector = V_PCINT0;
+      regs[R_GIFR] &= ~(1 << PCIE);
+    } else if (pending(V_TIM0_COMPA) && TIM0_COMPA_vect) {
+      vector = V_TIM0_COMPA;
+      regs[R_TIFR0] &= ~(1 << OCIE0A);
+    } else if (pending(V_ADC) && ADC_vect) {
+      vector = V_ADC;
+      regs[R_ADCSRA] &= ~(1 << ADIF);
+    } else {
+      break;
+    }
+    inIsr = true;
+    regs[R_SREG] &= ~0x80;
+    advance(30 * clockDiv()); // Vector jump, prologue and epilogue
+    if (vector == V_PCINT0)
+      PCINT0_vect();
+    else if (vector == V_TIM0_COMPA)
+      TIM0_COMPA_vect();
+    else
+      ADC_vect();
+    ++isrCount[vector];
+    regs[R_SREG] |= 0x80;
+    inIsr = false;
+    if (onIsr)
+      onIsr(vector);
+  }
+}
+
+void Chip::sleep() {
+  uint8_t mode = (regs[R_MCUCR] >> SM0) & 0x03;
+
+  sleepMode = mode == 0 ? SLEEP_IDLE : (mode == 1 ? SLEEP_ADC : SLEEP_PWR_DOWN);
+  if (! (regs[R_SREG] & 0x80))
+    abort(); // Would sleep forever
+  if (sleepMode == SLEEP_ADC) // Entering ADC noise reduction starts a conversion
+    adcStart();
+  while (! (pending(V_PCINT0) || (pending(V_TIM0_COMPA) && sleepMode == SLEEP_IDLE) || (pending(V_ADC) && sleepMode != SLEEP_PWR_DOWN))) {
+    uint64_t step = sleepMode == SLEEP_IDLE ? timerNext() : UINT64_MAX;
+
+    if (adcLeft)
+      step = std::min(step, adcLeft);
+    if (! events.empty())
+      step = std::min(step, events.front().time > now ? events.front().time - now : 0);
+    if (stopAt - std::min(stopAt, now) < step)
+      step = stopAt - std::min(stopAt, now) + 1;
+    if (step == UINT64_MAX)
+      abort(); // Nothing left to wake up on
+    step = std::max<uint64_t>(step, 1);
+    sleepTime[sleepMode] += step;
+    advance(step);
+  }
+  sleepMode = SLEEP_NONE;
+  advance(4 * clockDiv()); // Wake-up
+  dispatch();
+}
+
+} // namespace avrsim
+
+#endif
@@ -0,0 +1,224 @@
+/***
+ * Button edge to display latency benchmark of a firmware stage.
+ *
+ * Runs one stage against the host ATtiny13 model (host/avrsim.h,
+ * host/Arduino.h for the sketches of stages 0 and 1), presses a button at
+ * random phases relative to the timer tick with random contact bounce, and
+ * splits every press into:
+ *   bounce   - first edge to the last bounce edge (input, not firmware)
+ *   debounce - contact settled to the tick that changes the score; stages
+ *              0-3 count a click on release, when the pin change interrupt
+ *              posts it, so theirs includes the hold
+ *   loop     - score changed (or click posted) to the start of the frame
+ *              that shows it
+ *   bus      - frame start to the last data byte latched by the TM1637
+ *   total    - first edge to the last data byte
+ * With wake set (stage 4 only), every press comes after the display has
+ * blanked, so it only selects a side: debounce ends at the tick that
+ * leaves RUN_BLANK and the frame is the first one whose control byte turns
+ * the display back on. Built with -D INPUT_BACKEND=INPUT_HYBRID this
+ * includes the wake up from power-down.
+ *
+ * Build and run from the repository root, one binary per stage:
+ *   g++ -O2 -std=gnu++11 -Itools/host -I0/include -DSTAGE=4 -o latency tools/latency.cpp
+ *   ./latency [presses] [seed] [wake]
+ */
+
+#ifndef STAGE
+#define STAGE 4
+#endif
+
+#define AVRSIM_IMPLEMENTATION
+#include "avrsim.h"
+
+#define main firmwareMain
+#if STAGE == 0
+#include "../0/src/main.cpp"
+#elif STAGE == 1
+#include "../1/src/main.cpp"
+#elif STAGE == 2
+#include "../2/src/main.cpp"
+#elif STAGE == 3
+#include "../3/src/main.cpp"
+#elif STAGE == 4
+#include "../4/src/main.cpp"
+#else
+#error "No such stage"
+#endif
+#undef main
+
+#include <stdio.h>
+#include <random>
+
+using avrsim::chip;
+
+static const uint8_t SEGMENTS[10] = {
+  0B00111111, 0B00000110, 0B01011011, 0B01001111, 0B01100110, 0B01101101, 0B01111101, 0B0000111, 0B01111111, 0B01101111
+};
+
+struct sample_t {
+  uint64_t edge, settle, reg, frame, latched;
+  uint8_t newScore;
+};
+
+static std::vector<sample_t> samples;
+static size_t current = 0; // Sample waiting for its score change
+static size_t drawing = 0; // Sample waiting for its frame
+static uint8_t lastScore;
+static bool lastBlank;
+static uint32_t lastFrames = 0;
+static bool wake = false; // Presses wake a blank display instead of scoring
+
+static uint8_t shownScore() {
+#if STAGE == 4
+  return getScore(state, 1);
+#else
+  return score[1];
+#endif
+}
+
+static bool blank() {
+#if STAGE == 4
+  return getRunstate(state) == RUN_BLANK;
+#else
+  return false; // Stages 0-3 never blank
+#endif
+}
+
+static void onIsr(avrsim::vector_t) {
+  uint8_t s = shownScore();
+  bool off = blank();
+#if STAGE == 4
+  bool changed = wake ? lastBlank && (! off) : s != lastScore;
+#else
+  bool changed = (buttons[0] != BTN_RELEASED) || (buttons[1] != BTN_RELEASED); // The loop applies it next
+#endif
+
+  if (changed) {
+    if ((current < samples.size()) && (samples[current].edge <= chip.now) && (! samples[current].reg)) {
+      samples[current].reg = chip.now;
+      ++current;
+    }
+  }
+  lastScore = s;
+  lastBlank = off;
+}
+
+static void onBus() {
+  if (wake) { // The control byte turns the display on, with or without digits
+    if ((drawing < current) && (chip.tm.control & 0x08) && (chip.tm.startTime > samples[drawing].reg)) {
+      samples[drawing].frame = chip.tm.startTime;
+      samples[drawing].latched = chip.now;
+      ++drawing;
+    }
+    return;
+  }
+  if (chip.tm.frames == lastFrames) // Only look at complete frames
+    return;
+  lastFrames = chip.tm.frames;
+  while ((drawing < current) && (chip.tm.frameStartTime > samples[drawing].reg) && (chip.tm.lastDataTime >= chip.tm.frameStartTime)) {
+    sample_t &s = samples[drawing];
+    bool shown = (chip.tm.segments[2] == SEGMENTS[s.newScore / 10]) && (chip.tm.segments[3] == (SEGMENTS[s.newScore % 10] | 0x80));
+
+    if (! shown) // Stale or in the blank half of the blink
+      break;
+    s.frame = chip.tm.frameStartTime;
+    s.latched = chip.tm.lastDataTime;
+    ++drawing;
+  }
+}
+
+static void report(const char *name, std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  printf("%-9s %9.1f %9.1f %9.1f\n", name, v[v.size() / 2], v[v.size() * 99 / 100], v.back());
+}
+
+int main(int argc, char *argv[]) {
+  const uint64_t MS = F_CPU / 1000;
+#if STAGE == 4
+  const uint64_t BLANK = STATE_DURATION + FADE_TIME + 8 * FADE_STEP; // From the last press, at any brightness
+#else
+  const uint64_t BLANK = 0;
+#endif
+
+  unsigned presses = argc > 1 ? atoi(argv[1]) : 2000;
+  std::mt19937 rnd(argc > 2 ? atoi(argv[2]) : 1);
+  wake = (argc > 3) && atoi(argv[3]);
+  if (wake && (STAGE != 4)) {
+    fprintf(stderr, "Only stage 4 blanks its display\n");
+    return 1;
+  }
+  std::uniform_int_distribution<uint64_t> gap(wake ? BLANK * MS : 300 * MS, wake ? (BLANK + 5000) * MS : 1500 * MS); // Shorter than STATE_DURATION, or past the blank
+  std::uniform_int_distribution<uint64_t> hold(80 * MS, 300 * MS); // Shorter than HOLD_TIME and LONGCLICK_TIME
+  std::uniform_int_distribution<int> bounces(0, 6);
+  std::uniform_int_distribution<uint64_t> bounceTime(0, 5 * MS);
+
+  chip.onIsr = onIsr; // The chip was reset by its constructor, the sketches already set pins up
+  chip.onBus = onBus;
+  lastScore = shownScore();
+  lastBlank = blank();
+
+  uint64_t t = 200 * MS;
+  uint8_t expected = lastScore;
+
+  if (! wake) { // The first press only selects the right side
+    chip.input(t, BTN_PINS[1], false);
+    chip.input(t + 100 * MS, BTN_PINS[1], true);
+  }
+  t += gap(rnd);
+  for (unsigned n = 0; n < presses; ++n) {
+    const uint8_t PIN = BTN_PINS[(n / 30) & 0x01 ? 0 : 1]; // 30 times "+", then 30 times "-" to stay within 0..99
+
+    sample_t s = { t, t, 0, 0, 0, 0 };
+
+    expected += PIN == BTN_PINS[1] ? 1 : -1;
+    s.newScore = expected;
+    int b = bounces(rnd) * 2;
+    uint64_t end = t + bounceTime(rnd);
+
+    chip.input(t, PIN, false);
+    for (int i = 0; i < b; ++i) { // Odd edges open the contact, even ones close it
+      s.settle = t + (end - t) * (i + 1) / (b + 1);
+      chip.input(s.settle, PIN, ! (i & 0x01));
+    }
+    if (b) {
+      chip.input(end, PIN, false);
+      s.settle = end;
+    }
+    samples.push_back(s);
+    t = s.settle + hold(rnd);
+    chip.input(t, PIN, true);
+    t += gap(rnd);
+  }
+  chip.stopAt = t + 1000 * MS;
+
+  try {
+    firmwareMain();
+  } catch (const avrsim::Stop &) {
+  }
+
+  std::vector<double> bounce, debounce, loop, bus, total;
+  const double US = F_CPU / 1000000.0;
+
+  for (size_t i = 0; i < drawing; ++i) {
+    const sample_t &s = samples[i];
+
+    bounce.push_back((s.settle - s.edge) / US);
+    debounce.push_back((s.reg - s.settle) / US);
+    loop.push_back((s.frame - s.reg) / US);
+    bus.push_back((s.latched - s.frame) / US);
+    total.push_back((s.latched - s.edge) / US);
+  }
+  if (total.empty()) {
+    fprintf(stderr, "No press reached the display\n");
+    return 1;
+  }
+  printf("%zu of %zu presses, latency in us\n", total.size(), samples.size());
+  printf("%-9s %9s %9s %9s\n", "stage", "p50", "p99", "max");
+  report("bounce", bounce);
+  report("debounce", debounce);
+  report("loop", loop);
+  report("bus", bus);
+  report("total", total);
+  return 0;
+}
@@ -0,0 +1,365 @@
+/***
+ * Bounded exhaustive model check of the stage 4 button and run state logic.
+ *
+ * Drives the real TIM0_COMPA_vect of the default build (host/avrsim.h) from
+ * every state reached so far with every action, breadth first up to a depth.
+ * Besides the power up state, the first level holds every run state with
+ * each side at 0, 1, 98 and 99, and a selected side within the largest
+ * ACCEL step of 0 or 99 with a button held at each repeat stage, so the
+ * clamps are a press or a repeat away rather than 80 presses deep. The
+ * actions are
+ *   tick  - buttons held as in a mask (none, "-", "+", both) for one PRESS_TICK
+ *   run   - the same mask for as many ticks as it takes the scores, the run
+ *           state, the brightness or the chord to change (or a few seconds)
+ * States are the ISR globals with millis() taken relative to stateTime and
+ * the counters folded where the code cannot tell values apart, so equal
+ * states meet in one visited set. Every tick checks
+ *   range   - scores stay within 0..99, a blank display has brightness 0
+ *   timeout - a selected side never outlives STATE_DURATION
+ *   chord   - a finished chord leaves both scores at START_SCORE, no side
+ *             selected
+ * and the first violation is printed with the seed and the actions that
+ * lead to it.
+ * Each level is split across forked workers, which restore a state into
+ * the globals, run the ISR and stream the results back over a pipe.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -std=gnu++11 -Itools/host -o modelcheck tools/modelcheck.cpp
+ *   ./modelcheck [depth] [workers]
+ */
+
+#define AVRSIM_IMPLEMENTATION
+#include "avrsim.h"
+
+#define main firmwareMain
+#include "../4/src/main.cpp"
+#undef main
+
+#if KEYSCAN || ENCODER || ADAPTIVE_DEBOUNCE || BUZZER || ANIMATIONS || MATCH_MODE || UNDO || CLOCK_MODE
+#error "The model covers the globals of the default build only"
+#endif
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <unordered_map>
+
+using avrsim::chip;
+
+struct snap_t {
+  uint8_t scores[2];
+  uint8_t flags;
+  uint8_t pressed[2];
+  uint8_t released[2];
+  uint8_t chord;
+  uint16_t elapsed; // millis() - stateTime
+
+  bool operator==(const snap_t &o) const {
+    return ! memcmp(this, &o, sizeof(*this));
+  }
+};
+
+static_assert(sizeof(snap_t) == 10, "snap_t is hashed as raw bytes");
+
+struct snapHash {
+  size_t operator()(const snap_t &s) const {
+    uint64_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < sizeof(s); ++i)
+      h = (h ^ ((const uint8_t *)&s)[i]) * 1099511628211ULL;
+    return h;
+  }
+};
+
+// Streamed from a worker for every (state, action)
+struct result_t {
+  snap_t next;
+  uint32_t from; // Index in the level
+  uint8_t action;
+  uint8_t violation; // 0 - none, else a PROP_ value
+};
+
+enum prop_t : uint8_t { PROP_NONE, PROP_RANGE, PROP_TIMEOUT, PROP_CHORD };
+
+static const char *const PROPS[] = { "", "range", "timeout", "chord" };
+static const char *const MASKS[] = { "up", "-", "+", "both" };
+static const char *const RUNSTATES[] = { "idle", "left", "right", "blank" };
+
+const uint16_t BASE = 0x8000; // millis() of every restored state, even
+const uint8_t ACTIONS = 8; // Mask in bits 0..1, bit 2 - run
+const uint16_t RUN_TICKS = (FADE_TIME + STATE_DURATION) / PRESS_TICK; // Longest run
+
+static void load(const snap_t &s) {
+  for (uint8_t i = 0; i < 2; ++i) {
+    state.scores[i] = s.scores[i];
+    state.pressed[i] = s.pressed[i];
+    released[i] = s.released[i];
+  }
+  state.flags = s.flags;
+  chord = s.chord;
+  _ms = BASE;
+  stateTime = BASE - s.elapsed;
+}
+
+// Folds what the ISR cannot tell apart, see the notes on each line
+static snap_t save() {
+  snap_t s;
+
+  for (uint8_t i = 0; i < 2; ++i) {
+    s.scores[i] = state.scores[i];
+    s.pressed[i] = state.pressed[i];
+    s.released[i] = released[i] < DOUBLE_TICKS ? released[i] : 0xFF; // Only compared with DOUBLE_TICKS
+    if (chord && (s.pressed[i] > HOLD_TICKS)) // A chord only looks for HOLD_TICKS exactly and beyond
+      s.pressed[i] = HOLD_TICKS + 1;
+  }
+  s.flags = state.flags;
+  if ((s.pressed[0] < DEBOUNCE_TICKS) && (s.pressed[1] < DEBOUNCE_TICKS)) // The next accepted press resets it
+    s.flags &= ~REPEAT_MASK;
+  s.chord = chord;
+  s.elapsed = getRunstate(state) == RUN_BLANK ? 0 : (uint16_t)(_ms - stateTime); // Blank waits for input only
+  return s;
+}
+
+// One PRESS_TICK with the buttons in mask, returns a violated property
+static prop_t tick(uint8_t mask) {
+  uint8_t before = chord;
+
+  chip.extPins = 0xFF;
+  for (uint8_t i = 0; i < 2; ++i) {
+    if (mask & (1 << i))
+      chip.extPins &= ~(1 << BTN_PINS[i]);
+  }
+  for (uint8_t i = 0; i < PRESS_TICK; ++i)
+    TIM0_COMPA_vect();
+  if ((getScore(state, 0) > 99) || (getScore(state, 1) > 99) || ((getRunstate(state) == RUN_BLANK) && getBrightness(state)))
+    return PROP_RANGE;
+  if (((getRunstate(state) == RUN_LEFT) || (getRunstate(state) == RUN_RIGHT)) && ((uint16_t)(_ms - stateTime) > STATE_DURATION))
+    return PROP_TIMEOUT;
+  if (before && (! chord) && ((getScore(state, 0) != START_SCORE) || (getScore(state, 1) != START_SCORE) || (getRunstate(state) == RUN_LEFT) || (getRunstate(state) == RUN_RIGHT)))
+    return PROP_CHORD;
+  return PROP_NONE;
+}
+
+static prop_t act(uint8_t action) {
+  uint8_t mask = action & 0x03;
+  prop_t p;
+
+  if (! (action & 0x04))
+    return tick(mask);
+  for (uint16_t n = 0; n < RUN_TICKS; ++n) {
+    uint8_t scores[2] = { state.scores[0], state.scores[1] };
+    uint8_t look = state.flags & (RUNSTATE_MASK | BRIGHTNESS_MASK);
+    uint8_t wasChord = chord;
+
+    // Buttons up and settled, only time goes on until the next timeout
+    if ((! mask) && (! state.pressed[0]) && (! state.pressed[1]) && (released[0] >= DOUBLE_TICKS) && (released[1] >= DOUBLE_TICKS)) {
+      uint16_t elapsed = _ms - stateTime;
+      uint16_t limit = getRunstate(state) == RUN_IDLE ? FADE_TIME : getRunstate(state) == RUN_BLANK ? 0 : STATE_DURATION;
+
+      if (! limit) // Blank for good
+        break;
+      if (elapsed + PRESS_TICK < limit)
+        stateTime = _ms - (limit - PRESS_TICK);
+    }
+    if ((p = tick(mask)) != PROP_NONE)
+      return p;
+    if ((scores[0] != state.scores[0]) || (scores[1] != state.scores[1]) || (look != (state.flags & (RUNSTATE_MASK | BRIGHTNESS_MASK))) || (wasChord != chord))
+      break;
+  }
+  return PROP_NONE;
+}
+
+static void work(const std::vector<snap_t> &level, size_t first, size_t step, int fd) {
+  std::vector<result_t> out;
+
+  for (size_t k = first; k < level.size(); k += step) {
+    for (uint8_t a = 0; a < ACTIONS; ++a) {
+      result_t r;
+
+      load(level[k]);
+      r.violation = act(a);
+      r.next = save();
+      r.from = k;
+      r.action = a;
+      out.push_back(r);
+      if (out.size() == 4096) {
+        if (write(fd, out.data(), out.size() * sizeof(result_t)) < 0)
+          _exit(1);
+        out.clear();
+      }
+    }
+  }
+  if (! out.empty() && (write(fd, out.data(), out.size() * sizeof(result_t)) < 0))
+    _exit(1);
+}
+
+struct origin_t {
+  snap_t from;
+  uint8_t action;
+  uint8_t depth;
+};
+
+static void trace(const std::unordered_map<snap_t, origin_t, snapHash> &seen, snap_t s) {
+  std::vector<uint8_t> actions;
+  auto it = seen.find(s);
+
+  for (; it->second.depth; it = seen.find(it->second.from))
+    actions.push_back(it->second.action);
+  printf(" %s %u:%u", RUNSTATES[it->first.flags & RUNSTATE_MASK], it->first.scores[0], it->first.scores[1]);
+  for (uint8_t b = 0; b < 2; ++b) {
+    if (it->first.pressed[b])
+      printf(" %s held at repeat stage %u,", MASKS[b + 1], (it->first.flags & REPEAT_MASK) >> REPEAT_SHIFT);
+  }
+  for (auto a = actions.rbegin(); a != actions.rend(); ++a)
+    printf(" %s %s", *a & 0x04 ? "run" : "tick", MASKS[*a & 0x03]);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned depth = argc > 1 ? atoi(argv[1]) : 6;
+  unsigned workers = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+
+  chip.reset(TM_CLK_PIN, TM_DIO_PIN);
+
+  const uint8_t EDGES[] = { START_SCORE, 0, 1, 98, 99 };
+  const uint8_t LOOKS[4][2] = { { RUN_IDLE, DIM_BRIGHT }, { RUN_LEFT, NORMAL_BRIGHT }, { RUN_RIGHT, NORMAL_BRIGHT }, { RUN_BLANK, 0 } };
+
+  std::unordered_map<snap_t, origin_t, snapHash> seen;
+  std::vector<snap_t> level;
+  snap_t power = save();
+  uint64_t transitions = 0;
+  bool cells[4][8][8][3] = {}; // runstate, brightness, repeat stage, chord
+  auto start = std::chrono::steady_clock::now();
+
+  for (const uint8_t *look : LOOKS) { // The seeds, depth 0
+    for (uint8_t left : EDGES) {
+      for (uint8_t right : EDGES) {
+        load(power);
+        setScore(state, 0, left);
+        setScore(state, 1, right);
+        setRunstate(state, (runstate_t)look[0], look[1]);
+
+        snap_t s = save();
+
+        if (seen.insert({ s, { s, 0, 0 } }).second) {
+          cells[look[0]][look[1]][0][0] = true;
+          level.push_back(s);
+        }
+      }
+    }
+  }
+
+  uint8_t maxStep = 0;
+
+  for (uint8_t k = 0; k < ACCEL_STAGES; ++k)
+    maxStep = std::max(maxStep, (uint8_t)pgm_read_byte(&ACCEL[k].step));
+  for (uint8_t i = 0; i < 2; ++i) { // Side
+    for (uint8_t b = 0; b < 2; ++b) { // Button held, a repeat due on the next tick
+      for (uint8_t k = 0; k < ACCEL_STAGES; ++k) {
+        for (uint8_t n = 0; n <= maxStep; ++n) {
+          for (uint8_t score : { n, (uint8_t)(99 - n) }) {
+            load(power);
+            setScore(state, i, score);
+            setRunstate(state, (runstate_t)(RUN_LEFT + i), NORMAL_BRIGHT);
+            setRepeat(state, k);
+            state.pressed[b] = HOLD_TICKS - 1;
+
+            snap_t s = save();
+
+            if (seen.insert({ s, { s, 0, 0 } }).second) {
+              cells[RUN_LEFT + i][NORMAL_BRIGHT][k][0] = true;
+              level.push_back(s);
+            }
+          }
+        }
+      }
+    }
+  }
+  printf("depth %9s %9s\n", "states", "new");
+  for (unsigned d = 1; (d <= depth) && (! level.empty()); ++d) {
+    std::vector<snap_t> next;
+    std::vector<pid_t> pids;
+    std::vector<pollfd> fds;
+    std::vector<std::vector<uint8_t>> partial(workers);
+
+    fflush(stdout);
+    for (unsigned w = 0; w < workers; ++w) {
+      int p[2];
+
+      if (pipe(p) < 0)
+        return 1;
+      pid_t pid = fork();
+
+      if (! pid) {
+        close(p[0]);
+        work(level, w, workers, p[1]);
+        _exit(0);
+      }
+      close(p[1]);
+      pids.push_back(pid);
+      fds.push_back({ p[0], POLLIN, 0 });
+    }
+    for (size_t open = fds.size(); open; ) {
+      poll(fds.data(), fds.size(), -1);
+      for (unsigned w = 0; w < fds.size(); ++w) {
+        uint8_t buf[65536];
+        ssize_t n;
+
+        if ((fds[w].fd < 0) || (! fds[w].revents))
+          continue;
+        if ((n = read(fds[w].fd, buf, sizeof(buf))) <= 0) {
+          close(fds[w].fd);
+          fds[w].fd = -1;
+          --open;
+          continue;
+        }
+        partial[w].insert(partial[w].end(), buf, buf + n);
+        size_t whole = partial[w].size() / sizeof(result_t) * sizeof(result_t);
+
+        for (size_t o = 0; o < whole; o += sizeof(result_t)) {
+          result_t r;
+
+          memcpy(&r, &partial[w][o], sizeof(r));
+          ++transitions;
+          if (r.violation) {
+            seen.insert({ r.next, { level[r.from], r.action, (uint8_t)d } });
+            printf("VIOLATION %s after", PROPS[r.violation]);
+            trace(seen, level[r.from]);
+            printf(" %s %s\n", r.action & 0x04 ? "run" : "tick", MASKS[r.action & 0x03]);
+            for (pid_t pid : pids)
+              kill(pid, SIGKILL);
+            return 1;
+          }
+          if (seen.insert({ r.next, { level[r.from], r.action, (uint8_t)d } }).second) {
+            const snap_t &s = r.next;
+
+            cells[s.flags & RUNSTATE_MASK][(s.flags & BRIGHTNESS_MASK) >> BRIGHTNESS_SHIFT][(s.flags & REPEAT_MASK) >> REPEAT_SHIFT][s.chord] = true;
+            next.push_back(r.next);
+          }
+        }
+        partial[w].erase(partial[w].begin(), partial[w].begin() + whole);
+      }
+    }
+    for (pid_t pid : pids)
+      waitpid(pid, nullptr, 0);
+    printf("%5u %9zu %9zu\n", d, seen.size(), next.size());
+    level.swap(next);
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  unsigned reached = 0;
+  unsigned cellCount = (3 * 8 + 1) * ACCEL_STAGES * 3; // Blank at brightness 0 only, a few more the code never reaches
+
+  for (auto &r : cells)
+    for (auto &b : r)
+      for (auto &p : b)
+        for (bool c : p)
+          reached += c;
+  printf("No violation in %zu states, %llu transitions, %s\n", seen.size(), (unsigned long long)transitions, level.empty() ? "all reachable states seen" : "bounded");
+  printf("Coverage: %u of at most %u (runstate, brightness, repeat stage, chord) cells\n", reached, cellCount);
+  printf("%.2f s with %u workers, %.0f states/s\n", seconds, workers, seen.size() / seconds);
+  return 0;
+}
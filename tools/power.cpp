@@ -0,0 +1,206 @@
+/***
+ * Supply current and battery life estimate of a firmware stage.
+ *
+ * Runs one stage on the host ATtiny13 model (host/avrsim.h, host/Arduino.h for
+ * the sketches of stages 0 and 1) through a scripted hour of match use: a
+ * point every 8..40 sec. (select the side, then "-"), a reset when a score
+ * runs out and a 1..5 min. break between games. The time spent awake, in idle,
+ * ADC noise reduction and power-down sleep, the system clock cycles of each
+ * and the display RAM and brightness the TM1637 was given are then turned
+ * into currents with the typical figures below (5 V, 25 C), so a change in
+ * residency, clock prescaling or brightness shows up as a number, along
+ * with the interrupt rates behind it.
+ *
+ * Build and run from the repository root, one binary per stage:
+ *   g++ -O2 -std=gnu++11 -Itools/host -I0/include -DSTAGE=4 -o power tools/power.cpp
+ *   ./power [seed] [mAh]
+ */
+
+#ifndef STAGE
+#define STAGE 4
+#endif
+
+#define AVRSIM_IMPLEMENTATION
+#include "avrsim.h"
+
+#define main firmwareMain
+#if STAGE == 0
+#include "../0/src/main.cpp"
+#elif STAGE == 1
+#include "../1/src/main.cpp"
+#elif STAGE == 2
+#include "../2/src/main.cpp"
+#elif STAGE == 3
+#include "../3/src/main.cpp"
+#elif STAGE == 4
+#include "../4/src/main.cpp"
+#if KEYSCAN || ENCODER || CLOCK_MODE || MATCH_MODE
+#error "The script presses PB1/PB2 buttons and counts scores down"
+#endif
+#else
+#error "No such stage"
+#endif
+#undef main
+
+#include <stdio.h>
+#include <random>
+
+using avrsim::chip;
+
+// ATtiny13A, typical at 5 V from the supply current figures of the datasheet
+const double ACTIVE_MA_PER_MHZ = 0.5;
+const double IDLE_MA_PER_MHZ = 0.13;
+const double POWER_DOWN_MA = 0.00015; // Watchdog and BOD off
+const double ADC_MA = 0.25; // Added while the ADC is enabled
+
+// TM1637, every lit segment sinks its current for the pulse width of one of 6 grids
+const double SEGMENT_MA = 20;
+const uint8_t GRIDS = 6;
+const uint8_t PULSE[8] = { 1, 2, 4, 10, 11, 12, 13, 14 }; // Sixteenths, by brightness
+const double TM_MA = 1; // Controller itself, a guess, the datasheet gives none
+
+const uint32_t HOUR = 3600;
+
+static double displayCharge = 0; // mA * oscillator cycles
+static double displayOn = 0; // Oscillator cycles with the display on
+static double displayBright = 0; // Brightness * oscillator cycles while on
+static double displayMa = TM_MA;
+static uint64_t displayTime = 0;
+
+static double ledMa() {
+  if (! (chip.tm.control & 0x08)) // Display off
+    return 0;
+
+  uint8_t lit = 0;
+
+  for (uint8_t i = 0; i < GRIDS; ++i)
+    lit += __builtin_popcount(chip.tm.segments[i]);
+  return lit * SEGMENT_MA * PULSE[chip.tm.control & 0x07] / 16 / GRIDS;
+}
+
+// Integrates the display current up to now, it only changes when a byte is latched
+static void onBus() {
+  uint64_t span = chip.now - displayTime;
+
+  displayCharge += span * displayMa;
+  if (displayMa > TM_MA) {
+    displayOn += span;
+    displayBright += (double)span * (chip.tm.control & 0x07);
+  }
+  displayTime = chip.now;
+  displayMa = TM_MA + ledMa();
+}
+
+struct script_t {
+  std::mt19937 rnd;
+  uint64_t t;
+  uint32_t points, games;
+  uint8_t scores[2];
+
+  // Press and release of a button, then a pause
+  void press(uint8_t pin, uint32_t ms, uint32_t after = 400) {
+    chip.input(t, pin, false);
+    t += ms * (F_CPU / 1000);
+    chip.input(t, pin, true);
+    t += after * (F_CPU / 1000);
+  }
+
+  void reset() {
+#if STAGE == 4
+    chip.input(t, BTN_PINS[0], false); // Chord held
+    press(BTN_PINS[1], 800);
+    chip.input(t - 400 * (F_CPU / 1000), BTN_PINS[0], true);
+#else
+    for (uint8_t i = 0; i < 2; ++i) { // Select each side, then a long "+"
+      press(BTN_PINS[i], 150);
+      press(BTN_PINS[1], 800, STATE_DURATION + 500);
+    }
+#endif
+    scores[0] = scores[1] = MAX_SCORE;
+  }
+
+  void run(uint32_t seconds) {
+    std::uniform_int_distribution<uint32_t> rally(8000, 40000);
+    std::uniform_int_distribution<uint32_t> pause(60000, 300000);
+    std::uniform_int_distribution<int> side(0, 1);
+    uint64_t end = (uint64_t)seconds * F_CPU;
+
+    scores[0] = scores[1] = MAX_SCORE;
+    for (;;) {
+      uint8_t i = side(rnd);
+
+      t += rally(rnd) * (F_CPU / 1000);
+      if (t + F_CPU >= end) // Leaves time for the point to show up
+        break;
+      press(BTN_PINS[i], 150); // Selects the side that lost the point
+      press(BTN_PINS[0], 150);
+      ++points;
+      if (! --scores[i]) {
+        ++games;
+        t += 5000 * (F_CPU / 1000);
+        reset();
+        t += pause(rnd) * (F_CPU / 1000);
+      }
+    }
+  }
+};
+
+static uint8_t shownScore(uint8_t i) {
+#if STAGE == 4
+  return getScore(state, i);
+#else
+  return score[i];
+#endif
+}
+
+int main(int argc, char *argv[]) {
+  const double SECONDS = HOUR;
+
+  uint32_t seed = argc > 1 ? atoi(argv[1]) : 1;
+  double mah = argc > 2 ? atof(argv[2]) : 2000;
+  script_t script = { std::mt19937(seed), (uint64_t)F_CPU, 0, 0, { 0, 0 } };
+
+  script.run(HOUR);
+  chip.onBus = onBus; // The chip was reset by its constructor, the sketches already set pins up
+  chip.stopAt = (uint64_t)HOUR * F_CPU;
+  try {
+    firmwareMain();
+  } catch (const avrsim::Stop &) {
+  }
+  onBus();
+
+  double sleeping = 0;
+
+  for (uint8_t m = 0; m < avrsim::SLEEP_NONE; ++m)
+    sleeping += chip.sleepTime[m];
+
+  const char *NAMES[avrsim::SLEEP_NONE + 1] = { "idle", "adc", "power-down", "active" };
+  const double RESIDENCY[avrsim::SLEEP_NONE + 1] = {
+    (double)chip.sleepTime[avrsim::SLEEP_IDLE], (double)chip.sleepTime[avrsim::SLEEP_ADC], (double)chip.sleepTime[avrsim::SLEEP_PWR_DOWN], chip.now - sleeping
+  };
+  const double MA[avrsim::SLEEP_NONE + 1] = {
+    IDLE_MA_PER_MHZ * chip.clockCycles[avrsim::SLEEP_IDLE] / 1e6 / SECONDS,
+    POWER_DOWN_MA * chip.sleepTime[avrsim::SLEEP_ADC] / chip.now, // CPU and I/O clocks stopped, the ADC is added below
+    POWER_DOWN_MA * chip.sleepTime[avrsim::SLEEP_PWR_DOWN] / chip.now,
+    ACTIVE_MA_PER_MHZ * chip.clockCycles[avrsim::SLEEP_NONE] / 1e6 / SECONDS
+  };
+  double mcu = ADC_MA * chip.adcTime / chip.now;
+
+  printf("Stage %d, %u points in %u games, seed %u\n", STAGE, script.points, script.games, seed);
+  if ((shownScore(0) != script.scores[0]) || (shownScore(1) != script.scores[1]))
+    printf("Warning: scores %u:%u, the script expects %u:%u\n", shownScore(0), shownScore(1), script.scores[0], script.scores[1]);
+  printf("%-11s %8s %9s %9s\n", "mode", "time %", "MHz", "mA");
+  for (uint8_t m = 0; m <= avrsim::SLEEP_NONE; ++m) {
+    printf("%-11s %8.3f %9.3f %9.4f\n", NAMES[m], RESIDENCY[m] * 100 / chip.now, RESIDENCY[m] ? chip.clockCycles[m] * (double)F_CPU / RESIDENCY[m] / 1e6 : 0, MA[m]);
+    mcu += MA[m];
+  }
+  printf("%-11s %8.3f %9s %9.4f\n", "adc on", chip.adcTime * 100.0 / chip.now, "", ADC_MA * chip.adcTime / chip.now);
+  printf("Interrupts per second: timer %.1f, pin change %.1f\n", chip.isrCount[avrsim::V_TIM0_COMPA] / SECONDS, chip.isrCount[avrsim::V_PCINT0] / SECONDS);
+
+  double tm = displayCharge / chip.now;
+  double total = mcu + tm;
+
+  printf("MCU %.3f mA, display %.2f mA (on %.1f %%, mean brightness %.1f)\n", mcu, tm, displayOn * 100 / chip.now, displayOn ? displayBright / displayOn : 0);
+  printf("Total %.2f mA, %.0f h from %.0f mAh\n", total, mah / total, mah);
+  return 0;
+}
@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""Worst-case stack depth of an AVR firmware image.
+
+Walks the call graph in the disassembly of the linked ELF (so it sees the code
+after inlining and LTO), charges every function for its pushes, its frame and
+the return address of each call, and adds the deepest interrupt handler on top
+of the deepest path from main(). Handlers that re-enable interrupts (sei) may
+nest, so their depths are summed. The result is compared with the SRAM left
+after .data and .bss, which is also listed per variable. The flash taken by
+.text and .data is listed per function and checked against the flash size.
+
+Standalone:
+    python3 tools/stack_usage.py firmware.elf [--objdump avr-objdump] [--ram 64] [--flash 1024]
+
+As a PlatformIO post-build step (platformio.ini):
+    extra_scripts = post:../tools/stack_usage.py
+"""
+
+import re
+import subprocess
+import sys
+
+RAM_SIZE = 64  # ATtiny13
+FLASH_SIZE = 1024
+RETURN_ADDRESS = 2  # Bytes pushed by (r)call and by an interrupt
+
+LABEL = re.compile(r"^([0-9a-f]+) <(.+)>:$")
+INSN = re.compile(r"^\s*([0-9a-f]+):\s+(?:[0-9a-f]{2} )+\s*(\S+)\s*([^;]*)(?:;\s*0x([0-9a-f]+)(?: <([^>+]+)(?:\+0x[0-9a-f]+)?>)?)?")
+SECTION = re.compile(r"^\s*\d+\s+\.(data|bss|noinit)\s+([0-9a-f]+)")
+SYMBOL = re.compile(r"^[0-9a-f]+ ([0-9a-f]+) [bBdD] (\S+)$")
+CODE = re.compile(r"^\s*\d+\s+\.(text|data)\s+([0-9a-f]+)")
+FUNCTION = re.compile(r"^[0-9a-f]+ ([0-9a-f]+) [tT] (.+)$")
+
+
+class Function:
+    def __init__(self, name, address):
+        self.name = name
+        self.address = address
+        self.pushes = 0
+        self.frame = 0
+        self.calls = set()
+        self.tails = set()
+        self.indirect = False
+        self.sei = False
+
+
+def parse(objdump, elf):
+    text = subprocess.run([objdump, "-d", elf], check=True, capture_output=True, text=True).stdout
+    functions = {}
+    current = None
+    base = None
+    for line in text.splitlines():
+        m = LABEL.match(line)
+        if m:
+            current = Function(m.group(2), int(m.group(1), 16))
+            functions[current.name] = current
+            base = None
+            continue
+        m = INSN.match(line)
+        if not m or current is None:
+            continue
+        op, args, target = m.group(2), m.group(3).strip(), m.group(5)
+        if op == "push":
+            current.pushes += 1
+        elif op == "in" and args.replace(" ", "") == "r28,0x3d":  # Y = SP
+            base = True
+        elif op == "out" and args.replace(" ", "") == "0x3d,r28":  # SP = Y
+            base = None
+        elif base and op in ("subi", "sbiw") and args.startswith("r28"):
+            size = int(args.split(",")[1], 0)
+            if size < 0x80:  # subi with a negative constant releases the frame
+                current.frame += size
+        elif op in ("rcall", "call"):
+            if args.startswith(".+0"):  # rcall .+0 just reserves two bytes of frame
+                current.frame += RETURN_ADDRESS
+            elif target and target != current.name:
+                current.calls.add(target)
+        elif op in ("rjmp", "jmp") and target and target != current.name:
+            current.tails.add(target)
+        elif op in ("icall", "ijmp", "eicall", "eijmp"):
+            current.indirect = True
+        elif op == "sei":
+            current.sei = True
+    return functions
+
+
+def depth(functions, name, stack=()):
+    if name in stack:
+        raise RuntimeError("recursion: " + " -> ".join(stack + (name,)))
+    f = functions.get(name)
+    if f is None:
+        return 0
+    deepest = 0
+    for callee in f.calls:
+        deepest = max(deepest, RETURN_ADDRESS + depth(functions, callee, stack + (name,)))
+    own = f.pushes + f.frame + deepest
+    for callee in f.tails:  # Tail calls reuse the caller's return address
+        if callee in functions and functions[callee].address != 0:
+            own = max(own, depth(functions, callee, stack + (name,)))
+    return own
+
+
+def static_ram(objdump, elf):
+    text = subprocess.run([objdump, "-h", elf], check=True, capture_output=True, text=True).stdout
+    return sum(int(m.group(2), 16) for m in map(SECTION.match, text.splitlines()) if m)
+
+
+def flash(objdump, elf):
+    text = subprocess.run([objdump, "-h", elf], check=True, capture_output=True, text=True).stdout
+    return sum(int(m.group(2), 16) for m in map(CODE.match, text.splitlines()) if m)
+
+
+def symbols(objdump, elf, pattern):
+    nm = objdump[:-len("objdump")] + "nm" if objdump.endswith("objdump") else "avr-nm"
+    text = subprocess.run([nm, "-S", "-C", "--size-sort", "-r", elf], check=True, capture_output=True, text=True).stdout
+    return [(m.group(2), int(m.group(1), 16)) for m in map(pattern.match, text.splitlines()) if m]
+
+
+def variables(objdump, elf):
+    return symbols(objdump, elf, SYMBOL)
+
+
+def analyze(elf, objdump="avr-objdump", ram=RAM_SIZE, out=sys.stdout):
+    functions = parse(objdump, elf)
+    main = RETURN_ADDRESS + depth(functions, "main")
+    handlers = {name: RETURN_ADDRESS + depth(functions, name) for name in functions if name.startswith("__vector_") and name != "__vector_default"}
+    nesting = [d for name, d in handlers.items() if functions[name].sei]
+    isr = max(handlers.values(), default=0)
+    if nesting:  # Re-enabled interrupts let every other handler stack on top
+        isr = max(isr, sum(nesting) + max((d for name, d in handlers.items() if not functions[name].sei), default=0))
+    used = static_ram(objdump, elf)
+    print("Static: " + ", ".join("%s %d" % v for v in variables(objdump, elf)), file=out)
+    free = ram - used - main - isr
+    for name, d in sorted(handlers.items()):
+        print("  %-14s %3d bytes%s" % (name, d, " (nests)" if functions[name].sei else ""), file=out)
+    print("Stack: main %d + interrupts %d = %d bytes, static %d, free %d of %d" % (main, isr, main + isr, used, free, ram), file=out)
+    if any(f.indirect for f in functions.values()):
+        print("Warning: indirect calls are not followed", file=out)
+    return free
+
+
+def analyze_flash(elf, objdump="avr-objdump", size=FLASH_SIZE, out=sys.stdout):
+    used = flash(objdump, elf)
+    print("Code: " + ", ".join("%s %d" % f for f in symbols(objdump, elf, FUNCTION)), file=out)
+    print("Flash: %d bytes, free %d of %d" % (used, size - used, size), file=out)
+    return size - used
+
+
+def main(argv):
+    import argparse
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf")
+    parser.add_argument("--objdump", default="avr-objdump")
+    parser.add_argument("--ram", type=int, default=RAM_SIZE)
+    parser.add_argument("--flash", type=int, default=FLASH_SIZE)
+    args = parser.parse_args(argv)
+    free = analyze(args.elf, args.objdump, args.ram)
+    return 0 if (free >= 0) and (analyze_flash(args.elf, args.objdump, args.flash) >= 0) else 1
+
+
+try:
+    Import("env")  # noqa: F821 - provided by SCons when run by PlatformIO
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main(sys.argv[1:]))
+else:
+    def _post_build(source, target, env):
+        objdump = env.subst("$CC").replace("gcc", "objdump")
+        free = analyze(str(source[0]), objdump)
+        if (free < 0) or (analyze_flash(str(source[0]), objdump) < 0):
+            env.Exit(1)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", _post_build)  # noqa: F821